@@ -0,0 +1,341 @@
+#include "mega.pch"
+#include "sykerolabs.hpp"
+#include "sykero_csv.hpp"
+#include "sykero_gpio.hpp"
+#include "sykero_io.hpp"
+#include "sykero_mppt.hpp"
+#include "sykero_props.hpp"
+#include "sykero_time.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+// Runs without any of the hardware: the serial port is a pseudo terminal and the files live in tmpfs.
+// Usage: sykerolabs_bench [results.json]
+namespace sl::bench
+{
+	struct result
+	{
+		const char* name;
+		size_t iterations;
+		double nanoseconds_per_operation;
+	};
+
+	std::vector<result> results;
+
+	// Prevents the compiler from optimizing away the benchmarked code
+	template <typename T>
+	inline void keep(T&& value)
+	{
+		asm volatile("" : : "g"(&value) : "memory");
+	}
+
+	template <typename F>
+	void measure(const char* name, size_t iterations, F&& function)
+	{
+		// Warm up the caches
+		for (size_t i = 0; i < iterations / 10; ++i)
+		{
+			function(i);
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			function(i);
+		}
+
+		const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		const double per_operation = elapsed.count() / static_cast<double>(iterations);
+
+		std::printf("%-48s %12.1f ns/op\n", name, per_operation);
+
+		results.emplace_back(name, iterations, per_operation);
+	}
+
+	// A scratch file in tmpfs, removed when the benchmark is done
+	class scratch_file
+	{
+	public:
+		explicit scratch_file(const char* name) :
+			_path(std::filesystem::path("/dev/shm") / name)
+		{
+		}
+
+		~scratch_file()
+		{
+			std::filesystem::remove(_path);
+		}
+
+		SL_NON_COPYABLE(scratch_file);
+
+		const std::filesystem::path& path() const
+		{
+			return _path;
+		}
+
+	private:
+		std::filesystem::path _path;
+	};
+
+	// A block as sent by a SmartSolar MPPT, terminated by a checksum byte which makes the sum of the block zero
+	std::vector<uint8_t> recorded_block()
+	{
+		constexpr std::string_view FIELDS =
+			"\r\nPID\t0xA053"
+			"\r\nFW\t159"
+			"\r\nSER#\tHQ2132QY2KR"
+			"\r\nV\t13790"
+			"\r\nI\t-210"
+			"\r\nVPV\t15950"
+			"\r\nPPV\t42"
+			"\r\nCS\t3"
+			"\r\nMPPT\t2"
+			"\r\nOR\t0x00000000"
+			"\r\nERR\t0"
+			"\r\nLOAD\tON"
+			"\r\nIL\t200"
+			"\r\nH19\t3456"
+			"\r\nH20\t12"
+			"\r\nH21\t45"
+			"\r\nH22\t23"
+			"\r\nH23\t67"
+			"\r\nHSDS\t123"
+			"\r\nChecksum\t";
+
+		std::vector<uint8_t> block(FIELDS.begin(), FIELDS.end());
+
+		uint8_t sum = 0;
+
+		for (uint8_t byte : block)
+		{
+			sum += byte;
+		}
+
+		block.push_back(static_cast<uint8_t>(0x100 - sum));
+
+		return block;
+	}
+
+	void mppt_parse()
+	{
+		const int terminal = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+		if (terminal < 0 || grantpt(terminal) < 0 || unlockpt(terminal) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "posix_openpt");
+		}
+
+		// The controller configures the serial port, but the data is fed directly to the parser
+		io::file_descriptor master(terminal);
+		mppt::controller controller(ptsname(terminal));
+
+		const std::vector<uint8_t> block = recorded_block();
+
+		if (!controller.parse(block))
+		{
+			throw std::logic_error("the recorded block did not parse");
+		}
+
+		measure("mppt::controller::parse (block)", 100000, [&](size_t)
+		{
+			bool parsed = controller.parse(block);
+			keep(parsed);
+		});
+	}
+
+	void csv_append_row()
+	{
+		scratch_file scratch("sykerolabs_bench.csv");
+
+		csv::file<8u> csv(scratch.path(),
+		{
+			"Time",
+			"Temperature",
+			"Humidity",
+			"Pressure",
+			"Pump",
+			"Fan Speed",
+			"Battery Voltage",
+			"MPPT State"
+		});
+
+		measure("csv::file::append_row (tmpfs)", 100000, [&](size_t i)
+		{
+			csv.append_row(
+				"2024-02-28T16:45:18",
+				21.5f + static_cast<float>(i % 10),
+				45.25f,
+				1013.2f,
+				i % 2 ? STR_ON : STR_OFF,
+				static_cast<uint32_t>(1200 + i % 100),
+				13.79f,
+				3);
+		});
+	}
+
+	void properties()
+	{
+		rolling_average<60, float, std::milli> average;
+
+		constexpr std::array<std::string_view, 4> values = { "23456", "23500", "23375", "23420" };
+
+		measure("property_base::parse + commit", 1000000, [&](size_t i)
+		{
+			average.parse(values[i % values.size()]).commit();
+		});
+
+		measure("rolling_average::get", 1000000, [&](size_t)
+		{
+			float value = average.get();
+			keep(value);
+		});
+	}
+
+	void gpio_masks()
+	{
+		const std::set<uint32_t> offsets =
+		{
+			pins::WATER_LEVEL_SENSOR_1,
+			pins::WATER_LEVEL_SENSOR_2,
+			pins::PUMP_1_RELAY,
+			pins::PUMP_2_RELAY
+		};
+
+		const std::array<gpio::line_value_pair, 2> states =
+		{
+			gpio::line_value_pair(pins::PUMP_1_RELAY, false),
+			gpio::line_value_pair(pins::PUMP_2_RELAY, true)
+		};
+
+		measure("gpio::line_values (2 of 4 lines)", 1000000, [&](size_t)
+		{
+			gpio_v2_line_values values = gpio::line_values(offsets, states);
+			keep(values);
+		});
+	}
+
+	void timestamps()
+	{
+		constexpr size_t ITERATIONS = 1000000;
+		const auto base = std::chrono::floor<std::chrono::days>(std::chrono::system_clock::now());
+
+		measure("time::datetime_string", ITERATIONS, [&](size_t i)
+		{
+			std::string text = time::datetime_string(base + std::chrono::seconds(i));
+			keep(text);
+		});
+
+		time::timestamp_formatter formatter;
+		char buffer[time::timestamp_formatter::MAX_LENGTH];
+
+		measure("time::timestamp_formatter::datetime", ITERATIONS, [&](size_t i)
+		{
+			std::string_view text = formatter.datetime(base + std::chrono::seconds(i), buffer);
+			keep(text);
+		});
+
+		measure("time::timestamp_formatter::iso8601", ITERATIONS, [&](size_t i)
+		{
+			std::string_view text = formatter.iso8601(base + std::chrono::seconds(i), buffer);
+			keep(text);
+		});
+
+		measure("time::timestamp_formatter::epoch_millis", ITERATIONS, [&](size_t i)
+		{
+			std::string_view text = time::timestamp_formatter::epoch_millis(base + std::chrono::seconds(i), buffer);
+			keep(text);
+		});
+	}
+
+	void peek_some()
+	{
+		scratch_file scratch("sykerolabs_bench_temp");
+
+		{
+			io::file_descriptor file(scratch.path(), O_WRONLY | O_CREAT | O_TRUNC);
+			file.write_text("48312\n");
+		}
+
+		io::file_descriptor sysfs(scratch.path());
+
+		measure("io::peek_some (tmpfs)", 100000, [&](size_t)
+		{
+			std::string value = io::peek_some(sysfs);
+			keep(value);
+		});
+	}
+
+	std::string platform()
+	{
+		std::ifstream model("/sys/firmware/devicetree/base/model");
+		std::string name;
+
+		if (!std::getline(model, name, '\0') || name.empty())
+		{
+			return "unknown";
+		}
+
+		return name;
+	}
+
+	void write_json(const std::filesystem::path& path)
+	{
+#ifdef NDEBUG
+		constexpr char BUILD_TYPE[] = "release";
+#else
+		constexpr char BUILD_TYPE[] = "debug";
+#endif
+		std::string json = "{\n";
+		json += "\t\"platform\": \"" + platform() + "\",\n";
+		json += "\t\"compiler\": \"" __VERSION__ "\",\n";
+		json += "\t\"build_type\": \"" + std::string(BUILD_TYPE) + "\",\n";
+		json += "\t\"build_date\": \"" __DATE__ " " __TIME__ "\",\n";
+		json += "\t\"results\":\n\t[\n";
+
+		char line[0x100];
+
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			std::snprintf(line, sizeof(line),
+				"\t\t{ \"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.2f }%s\n",
+				results[i].name,
+				results[i].iterations,
+				results[i].nanoseconds_per_operation,
+				i + 1 < results.size() ? "," : "");
+
+			json += line;
+		}
+
+		json += "\t]\n}\n";
+
+		io::file_descriptor file(path, O_WRONLY | O_CREAT | O_TRUNC);
+		file.write_text(json);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		sl::bench::mppt_parse();
+		sl::bench::csv_append_row();
+		sl::bench::properties();
+		sl::bench::gpio_masks();
+		sl::bench::timestamps();
+		sl::bench::peek_some();
+
+		if (argc > 1)
+		{
+			sl::bench::write_json(argv[1]);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
\ No newline at end of file
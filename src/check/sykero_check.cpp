@@ -0,0 +1,767 @@
+#include "mega.pch"
+#include "sykerolabs.hpp"
+#include "sykero_csv.hpp"
+#include "sykero_props.hpp"
+#include "sykero_devices.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <syslog.h>
+
+namespace
+{
+	// The records which fell back to syslog
+	std::mutex syslog_mutex;
+	std::vector<std::string> syslog_lines;
+
+	// The descriptor whose next receive fails with ENOBUFS, as a netlink socket does when its buffer has overflowed
+	std::atomic<int> overflowing_descriptor = -1;
+}
+
+// Takes the place of the one in libc, so that the syslog fallback of the log facility can be checked
+extern "C" void syslog(int, const char* format, ...)
+{
+	char line[0x200];
+	va_list arguments;
+	va_start(arguments, format);
+	std::vsnprintf(line, sizeof(line), format, arguments);
+	va_end(arguments);
+
+	std::lock_guard<std::mutex> lock(syslog_mutex);
+	syslog_lines.emplace_back(line);
+}
+
+// The same for recv, so that the overflow of the uevent monitor can be checked without flooding netlink
+extern "C" ssize_t recv(int descriptor, void* buffer, size_t size, int flags)
+{
+	int expected = descriptor;
+
+	if (overflowing_descriptor.compare_exchange_strong(expected, -1))
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return syscall(SYS_recvfrom, descriptor, buffer, size, flags, nullptr, nullptr);
+}
+
+// Checks the claims which are easy to break and hard to notice in the simulation, without any of the hardware.
+// Exits with a non-zero code if any of the checks fails.
+// Usage: sykerolabs_check
+namespace sl::check
+{
+	// A scratch file or directory in tmpfs, removed when the check is done
+	class scratch_file
+	{
+	public:
+		explicit scratch_file(const char* name) :
+			_path(std::filesystem::path("/dev/shm") / name)
+		{
+			std::filesystem::remove_all(_path);
+		}
+
+		~scratch_file()
+		{
+			std::filesystem::remove_all(_path);
+		}
+
+		SL_NON_COPYABLE(scratch_file);
+
+		const std::filesystem::path& path() const
+		{
+			return _path;
+		}
+
+	private:
+		std::filesystem::path _path;
+	};
+
+	// Binds a datagram socket as a stand-in for the journal and collects the records sent to it, each as its fields.
+	// Collects on a thread of its own, because the log worker blocks once a few datagrams are queued.
+	class journal_socket
+	{
+	public:
+		using fields = std::map<std::string, std::string, std::less<>>;
+
+		explicit journal_socket(const char* name) :
+			_scratch(name),
+			_socket(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+		{
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			_scratch.path().string().copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+			if (bind(_socket.descriptor(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				throw std::system_error(errno, std::system_category(), "bind");
+			}
+
+			const timeval timeout = { 0, 100000 };
+			setsockopt(_socket.descriptor(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			_receiver = std::jthread([this](std::stop_token stop)
+			{
+				char datagram[0x1000];
+
+				// Until the queued datagrams are drained after the stop, i.e. until a receive times out
+				while (true)
+				{
+					const ssize_t size = recv(_socket.descriptor(), datagram, sizeof(datagram), 0);
+
+					if (size > 0)
+					{
+						std::lock_guard<std::mutex> lock(_mutex);
+						_records.push_back(parse(std::string_view(datagram, static_cast<size_t>(size))));
+					}
+					else if (stop.stop_requested())
+					{
+						break;
+					}
+				}
+			});
+		}
+
+		SL_NON_COPYABLE(journal_socket);
+
+		const std::filesystem::path& path() const
+		{
+			return _scratch.path();
+		}
+
+		// Stops collecting, call after the log facility is destroyed, i.e. every record has been sent
+		std::vector<fields> records()
+		{
+			_receiver.request_stop();
+			_receiver.join();
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _records;
+		}
+
+	private:
+		static fields parse(std::string_view datagram)
+		{
+			fields result;
+
+			for (const auto line : std::views::split(datagram, '\n'))
+			{
+				const std::string_view field(line.begin(), line.end());
+				const size_t separator = field.find('=');
+
+				if (separator != std::string_view::npos)
+				{
+					result.emplace(field.substr(0, separator), field.substr(separator + 1));
+				}
+			}
+
+			return result;
+		}
+
+		scratch_file _scratch;
+		io::file_descriptor _socket;
+		std::mutex _mutex;
+		std::vector<fields> _records;
+		std::jthread _receiver;
+	};
+
+	// A new file, as of a device which is back, so that a descriptor of the old one keeps reading the old text
+	void write_file(const std::filesystem::path& path, std::string_view text)
+	{
+		std::filesystem::remove(path);
+		std::ofstream(path) << text;
+	}
+
+	void send_datagram(const std::filesystem::path& path, std::string_view datagram)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		path.string().copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+		io::file_descriptor sender(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+
+		if (sendto(sender.descriptor(), datagram.data(), datagram.size(), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "sendto");
+		}
+	}
+
+	// As the kernel sends them: "ACTION@DEVPATH" followed by KEY=VALUE pairs, each terminated by a null character
+	std::string kernel_uevent(std::string_view action, std::string_view subsystem, std::string_view devpath)
+	{
+		std::string datagram;
+		datagram.append(action).append("@").append(devpath).push_back('\0');
+		datagram.append("ACTION=").append(action).push_back('\0');
+		datagram.append("DEVPATH=").append(devpath).push_back('\0');
+		datagram.append("SUBSYSTEM=").append(subsystem).push_back('\0');
+		datagram.append("SEQNUM=1234").push_back('\0');
+		return datagram;
+	}
+
+	void expect(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			throw std::runtime_error(what);
+		}
+	}
+
+	std::string format_time(std::time_t time)
+	{
+		std::tm tm;
+		localtime_r(&time, &tm);
+
+		char text[0x20];
+		return std::string(text, std::strftime(text, sizeof(text), "%FT%T", &tm));
+	}
+
+	// Writes a dense series in the change-driven mode, with a restart in the middle, and reconstructs it with the sparse reader.
+	// The reconstructed rows must be the dense ones, every value within its deadband, and the downtime must stay a gap.
+	void csv_round_trip()
+	{
+		constexpr size_t KEYFRAME_INTERVAL = 10;
+		constexpr std::chrono::seconds PERIOD(60);
+		constexpr float DEADBAND = 0.5f;
+
+		struct row
+		{
+			std::string time;
+			float temperature;
+			uint32_t speed;
+			std::string_view relay;
+		};
+
+		std::tm start;
+		mem::clear(start);
+		start.tm_year = 2026 - 1900;
+		start.tm_mon = 5;
+		start.tm_mday = 1;
+		start.tm_isdst = -1;
+		const std::time_t midnight = std::mktime(&start);
+
+		// Two runs of the process, three hours apart
+		std::vector<row> dense;
+
+		for (size_t i = 0; i < 300; ++i)
+		{
+			const std::time_t time = midnight + static_cast<std::time_t>(i < 150 ? i : i + 180) * PERIOD.count();
+			const float temperature = 20.0f + 3.0f * std::sin(static_cast<float>(i) / 40.0f);
+			const uint32_t speed = i % 70 < 30 ? 1200 : 0;
+			dense.push_back({ format_time(time), temperature, speed, i % 50 < 25 ? STR_OFF : STR_ON });
+		}
+
+		scratch_file scratch("sykerolabs_check.csv");
+		const std::array<std::string_view, 4> header = { "Time", "Temperature", "Speed", "Relay" };
+
+		for (size_t begin : { 0, 150 })
+		{
+			csv::file<4u> csv(scratch.path(), header);
+			csv.enable_deadbands({ 0.0f, DEADBAND, 0.0f, 0.0f }, KEYFRAME_INTERVAL);
+
+			for (size_t i = begin; i < begin + 150; ++i)
+			{
+				csv.append_row(dense[i].time, dense[i].temperature, dense[i].speed, dense[i].relay);
+			}
+		}
+
+		csv::sparse_reader<4u> reader(PERIOD, KEYFRAME_INTERVAL);
+		std::vector<std::string> reconstructed;
+		std::ifstream input(scratch.path());
+		size_t written = 0;
+
+		for (std::string line; std::getline(input, line); ++written)
+		{
+			reader.feed(line, [&](std::string&& text)
+			{
+				reconstructed.push_back(std::move(text));
+			});
+		}
+
+		expect(written < dense.size(), "the change-driven mode skipped no rows");
+		expect(reconstructed.size() > 1 && reconstructed.size() <= dense.size() + 1, "the reconstructed row count is off");
+
+		// Each reconstructed row must be the dense row at its time. Only the rows skipped after the last written row of a run,
+		// i.e. the ones which no later row vouches for, may be missing.
+		size_t i = 0;
+
+		for (size_t r = 1; r < reconstructed.size(); ++r, ++i)
+		{
+			char time[0x20] = {};
+			char relay[0x10] = {};
+			float temperature = 0.0f;
+			uint32_t speed = 0;
+
+			expect(std::sscanf(reconstructed[r].c_str(), "%19[^,],%f,%u,%15[^\r]", time, &temperature, &speed, relay) == 4, "a reconstructed row is malformed");
+
+			while (i < dense.size() && dense[i].time != time)
+			{
+				expect(i % 150 >= 150 - KEYFRAME_INTERVAL, "a row in the middle of a run is missing, or a row was made up");
+				++i;
+			}
+
+			expect(i < dense.size(), "a reconstructed row has a time which was not written");
+			expect(std::abs(dense[i].temperature - temperature) <= DEADBAND, "a reconstructed value is outside its deadband");
+			expect(dense[i].speed == speed, "a reconstructed value differs");
+			expect(dense[i].relay == relay, "a reconstructed text differs");
+		}
+
+		expect(dense.size() - i < KEYFRAME_INTERVAL, "too many rows are missing at the end");
+
+		std::printf("csv round trip: %zu of %zu rows written, %zu reconstructed\n", written - 1, dense.size(), reconstructed.size() - 1);
+	}
+
+	// A row which does not fit must fail alone: the next row must be written whole, as a keyframe, and not after the failed half.
+	void csv_failed_row()
+	{
+		scratch_file scratch("sykerolabs_check_failed.csv");
+		const std::array<std::string_view, 3> header = { "Time", "Temperature", "Relay" };
+		const std::string runaway(0x100, 'x');
+
+		{
+			csv::file<3u> csv(scratch.path(), header);
+			csv.enable_deadbands({ 0.0f, 0.5f, 0.0f }, 10);
+			csv.append_row("2026-06-01T00:00:00", 20.0f, STR_OFF);
+
+			bool failed = false;
+
+			try
+			{
+				csv.append_row("2026-06-01T00:01:00", 30.0f, runaway);
+			}
+			catch (const std::length_error&)
+			{
+				failed = true;
+			}
+
+			expect(failed, "a runaway value did not fail the row");
+
+			// Within the deadband of the failed row, which must not count as written
+			csv.append_row("2026-06-01T00:02:00", 30.1f, STR_OFF);
+		}
+
+		std::ifstream input(scratch.path());
+		std::vector<std::string> lines;
+
+		for (std::string line; std::getline(input, line);)
+		{
+			lines.push_back(line);
+		}
+
+		expect(lines.size() == 3, "the failed row was written, or the next one was lost");
+		expect(lines[2] == "2026-06-01T00:02:00,30.100000,off\r", "the row after the failed one is not a whole keyframe");
+
+		std::printf("csv failed row: the next row was a keyframe\n");
+	}
+
+	// Logs through the facility into a stand-in journal socket: a record must carry its priority, file and line as fields,
+	// a burst from one call site must be cut at RATE_LIMIT_BURST and the rest summarized, and without the socket the records
+	// must fall back to syslog.
+	void log_records()
+	{
+		{
+			journal_socket journal("sykerolabs_check_journal.sock");
+
+			const unsigned record_line = __LINE__ + 5;
+			unsigned burst_line = 0;
+
+			{
+				log::facility facility(LOG_USER, "sykerolabs_check", { "SYKEROLABS_CHECK=1" }, journal.path().c_str());
+				log_error("record %d\nof two lines", 42);
+
+				for (size_t i = 0; i < log::RATE_LIMIT_BURST + 8; ++i)
+				{
+					burst_line = __LINE__ + 1;
+					log_warning("burst %zu", i);
+				}
+			}
+
+			const std::vector<journal_socket::fields> records = journal.records();
+
+			const auto record = std::ranges::find_if(records, [](const journal_socket::fields& fields)
+			{
+				return fields.contains("MESSAGE") && fields.at("MESSAGE").starts_with("record ");
+			});
+
+			expect(record != records.end(), "the record was not sent to the journal socket");
+			expect(record->at("MESSAGE") == "record 42 of two lines", "the message was not kept on one line");
+			expect(record->at("PRIORITY") == "3", "the priority field is wrong");
+			expect(record->at("CODE_FILE") == "sykero_check.cpp", "the file field is not the base name of the source");
+			expect(record->at("CODE_LINE") == std::to_string(record_line), "the line field is wrong");
+			expect(record->at("SYSLOG_IDENTIFIER") == "sykerolabs", "the identifier field is wrong");
+			expect(record->contains("TID") && record->contains("SYSLOG_PID"), "the process fields are missing");
+			expect(record->contains("SYKEROLABS_CHECK") && record->at("SYKEROLABS_CHECK") == "1", "the custom field is missing");
+
+			const auto burst = std::ranges::count_if(records, [](const journal_socket::fields& fields)
+			{
+				return fields.contains("MESSAGE") && fields.at("MESSAGE").starts_with("burst ");
+			});
+
+			const auto summary = std::ranges::find_if(records, [](const journal_socket::fields& fields)
+			{
+				return fields.contains("MESSAGE") && fields.at("MESSAGE") == "suppressed 8 similar messages.";
+			});
+
+			expect(burst == log::RATE_LIMIT_BURST, "the burst was not cut at RATE_LIMIT_BURST");
+			expect(summary != records.end(), "the suppressed messages were not summarized");
+			expect(summary->at("PRIORITY") == "4" && summary->at("CODE_LINE") == std::to_string(burst_line), "the summary is not of the call site");
+
+			std::printf("log records: %zu sent to the journal socket, %lld of a burst of %zu\n", records.size(), static_cast<long long>(burst), log::RATE_LIMIT_BURST + 8);
+		}
+
+		{
+			scratch_file missing("sykerolabs_check_missing.sock");
+
+			{
+				std::lock_guard<std::mutex> lock(syslog_mutex);
+				syslog_lines.clear();
+			}
+
+			const unsigned fallback_line = __LINE__ + 4;
+
+			{
+				log::facility facility(LOG_USER, "sykerolabs_check", {}, missing.path().c_str());
+				log_error("fallback %d", 7);
+			}
+
+			std::lock_guard<std::mutex> lock(syslog_mutex);
+
+			const std::string expected = "sykero_check.cpp:" + std::to_string(fallback_line) + ": fallback 7";
+			expect(std::ranges::find(syslog_lines, expected) != syslog_lines.end(), "the record did not fall back to syslog");
+			expect(std::ranges::any_of(syslog_lines, [](const std::string& line) { return line.ends_with("not available, using syslog."); }),
+				"the fallback was not logged");
+
+			std::printf("log records: %zu fell back to syslog\n", syslog_lines.size());
+		}
+	}
+
+	// Feeds uevents to the monitor through its local socket and a fake IIO tree to the device supervision: the monitor must parse
+	// the kernel datagrams, skip the ones forwarded by udev and report an overflow as ACTION_LOST, and a device which is back
+	// must be reopened while the other one is still missing.
+	void uevent_monitor()
+	{
+		scratch_file scratch("sykerolabs_check_devices");
+		const std::filesystem::path iio = scratch.path() / "iio";
+		const std::filesystem::path iio_prefix = iio / "iio:device";
+
+		const auto create_device = [&](const std::filesystem::path& device, std::string_view name, std::initializer_list<std::pair<const char*, const char*>> files)
+		{
+			std::filesystem::create_directories(device);
+			write_file(device / "name", std::string(name) + "\n");
+
+			for (const auto& [file, text] : files)
+			{
+				write_file(device / file, text);
+			}
+		};
+
+		const auto read = [](const io::file_descriptor& file)
+		{
+			char text[0x20];
+			return std::string(io::peek_some(file, text));
+		};
+
+		create_device(iio / "iio:device0", "bme680", { { "in_temp_input", "21000\n" }, { "in_humidityrelative_input", "60\n" }, { "in_pressure_input", "1013\n" } });
+		create_device(iio / "iio:device1", "ads1015", { { "in_voltage0_raw", "800\n" }, { "in_voltage1_raw", "760\n" } });
+		write_file(scratch.path() / "temp", "45000\n");
+
+		const std::filesystem::path socket_path = scratch.path() / "uevent.sock";
+		uevent::monitor monitor(socket_path);
+		devices::sensor_files sensors(scratch.path() / "temp", iio_prefix);
+		uevent::event event;
+
+		// A forwarded event has a binary header of its own instead of ACTION@DEVPATH
+		std::string forwarded("libudev\0\xfe\xed\xca\xfe", 12);
+		forwarded.append("ACTION=add").push_back('\0');
+		forwarded.append("SUBSYSTEM=iio").push_back('\0');
+		send_datagram(socket_path, forwarded);
+
+		std::string added = kernel_uevent("add", "tty", "/devices/check/ttyUSB0");
+		added.append("DEVNAME=ttyUSB0").push_back('\0');
+		send_datagram(socket_path, added);
+
+		expect(monitor.receive(event), "the kernel event was not received");
+		expect(event.action == "add" && event.subsystem == "tty", "the action or the subsystem was not parsed");
+		expect(event.devpath == "/devices/check/ttyUSB0" && event.devname == "ttyUSB0", "the device path or the name was not parsed");
+		expect(!monitor.receive(event), "the forwarded event was not skipped");
+
+		overflowing_descriptor = monitor.descriptor();
+		expect(monitor.receive(event) && event.action == uevent::ACTION_LOST, "an overflow was not reported as lost");
+		expect(!monitor.receive(event), "an event was made up after the overflow");
+
+		// Any device may have come and gone, so the serial port is reopened too
+		overflowing_descriptor = monitor.descriptor();
+		expect(devices::supervise(monitor, sensors), "the serial port is not reopened after an overflow");
+
+		// The BME680 drops off the bus, and the ADS1015 comes back as another device
+		std::filesystem::rename(iio / "iio:device0", scratch.path() / "gone");
+		std::filesystem::rename(iio / "iio:device1", iio / "iio:device2");
+		write_file(iio / "iio:device2" / "in_voltage0_raw", "900\n");
+		send_datagram(socket_path, kernel_uevent("remove", "iio", "/devices/check/iio:device0"));
+		send_datagram(socket_path, kernel_uevent("remove", "iio", "/devices/check/iio:device1"));
+		send_datagram(socket_path, kernel_uevent("add", "iio", "/devices/check/iio:device2"));
+
+		expect(!devices::supervise(monitor, sensors), "the serial port is reopened for an IIO device");
+		expect(read(sensors.pool1_ec) == "900\n", "the device which is back was not reopened while the other one is missing");
+		expect(read(sensors.air_temperature) == "21000\n", "the missing device lost its descriptors");
+
+		create_device(iio / "iio:device3", "bme680", { { "in_temp_input", "22000\n" }, { "in_humidityrelative_input", "61\n" }, { "in_pressure_input", "1012\n" } });
+		send_datagram(socket_path, kernel_uevent("add", "iio", "/devices/check/iio:device3"));
+
+		expect(!devices::supervise(monitor, sensors), "the serial port is reopened for an IIO device");
+		expect(read(sensors.air_temperature) == "22000\n", "the device which came back later was not reopened");
+		expect(read(sensors.pool1_ec) == "900\n", "the other device was lost on the second reopen");
+
+		std::printf("uevent monitor: parsed, skipped the forwarded event, lost on overflow, reopened one device and then the other\n");
+	}
+
+	// A minute without samples, e.g. while a sensor is off the bus, must be summarized as empty instead of as the previous minute,
+	// and written as nan also in the change-driven mode, where an empty cell would repeat the previous value.
+	void rollup_empty_minute()
+	{
+		rollup<float> temperature;
+		temperature.update(20.0f);
+		temperature.update(22.0f);
+
+		const rollup_summary<float> full = temperature.summarize();
+		const rollup_summary<float> empty = temperature.summarize();
+
+		expect(full.count == 2 && full.minimum == 20.0f && full.maximum == 22.0f && full.mean == 21.0f, "a minute was summarized wrong");
+		expect(empty.count == 0 && std::isnan(empty.minimum) && std::isnan(empty.maximum) && std::isnan(empty.mean), "an empty minute repeated the previous one");
+
+		scratch_file scratch("sykerolabs_check_rollup.csv");
+		const std::array<std::string_view, 2> header = { "Time", "Temperature" };
+
+		{
+			csv::file<2u> csv(scratch.path(), header);
+			csv.enable_deadbands({ 0.0f, 0.5f }, 10);
+			csv.append_row("2026-06-01T00:00:00", full.mean);
+			csv.append_row("2026-06-01T00:01:00", empty.mean);
+			csv.append_row("2026-06-01T00:02:00", empty.mean);
+			csv.append_row("2026-06-01T00:03:00", full.mean);
+		}
+
+		std::ifstream input(scratch.path());
+		std::vector<std::string> lines;
+
+		for (std::string line; std::getline(input, line);)
+		{
+			lines.push_back(line);
+		}
+
+		expect(lines.size() == 4, "the empty minutes were not written as changes");
+		expect(lines[2] == "2026-06-01T00:01:00,nan\r", "an empty minute was not written as nan");
+		expect(lines[3] == "2026-06-01T00:03:00,21.000000\r", "the value after the empty minutes was not written");
+
+		std::printf("rollup empty minute: summarized as empty and written as nan\n");
+	}
+
+	// Feeds the windowed properties samples at irregular times, so that the windows are cut both by time and by capacity,
+	// and compares each of them after every sample to a brute force recomputation over the same window.
+	void windowed_statistics()
+	{
+		constexpr size_t N = 16;
+		constexpr std::chrono::seconds SPAN(10);
+		constexpr size_t SAMPLES = 2000;
+
+		windowed_average<N, double> average(SPAN);
+		windowed_minimum<N, int> minimum(SPAN);
+		windowed_maximum<N, int> maximum(SPAN);
+		windowed_variance<N, double> variance(SPAN);
+
+		std::vector<std::pair<sample_clock::time_point, int>> history;
+		sample_clock::time_point time;
+		uint32_t random = 1;
+		size_t by_time = 0;
+		size_t by_capacity = 0;
+		size_t first = 0;
+
+		for (size_t i = 0; i < SAMPLES; ++i)
+		{
+			// Now and then a burst, so that the window fills up before the span has passed
+			random = random * 1664525u + 1013904223u;
+			time += std::chrono::milliseconds(i % 200 < 50 ? 100 + random % 200 : random % 1500);
+			const int value = static_cast<int>(random >> 16) % 1000 - 500;
+
+			history.emplace_back(time, value);
+			average.update(value, time);
+			minimum.update(value, time);
+			maximum.update(value, time);
+			variance.update(value, time);
+
+			while (history[first].first + SPAN <= time)
+			{
+				++first;
+				++by_time;
+			}
+
+			if (history.size() - first > N)
+			{
+				by_capacity += history.size() - first - N;
+				first = history.size() - N;
+			}
+
+			const auto window = std::span(history).subspan(first);
+			double sum = 0.0;
+			int low = window.front().second;
+			int high = window.front().second;
+
+			for (const auto& [t, v] : window)
+			{
+				sum += v;
+				low = std::min(low, v);
+				high = std::max(high, v);
+			}
+
+			const double mean = sum / static_cast<double>(window.size());
+			double squares = 0.0;
+
+			for (const auto& [t, v] : window)
+			{
+				squares += (v - mean) * (v - mean);
+			}
+
+			const double expected_variance = window.size() > 1 ? squares / static_cast<double>(window.size() - 1) : 0.0;
+
+			expect(std::abs(average.get() - mean) < 1e-9, "the windowed average differs");
+			expect(minimum.get() == low, "the windowed minimum differs");
+			expect(maximum.get() == high, "the windowed maximum differs");
+			expect(std::abs(variance.mean() - mean) < 1e-6, "the mean of the windowed variance differs");
+			expect(std::abs(variance.get() - expected_variance) < 1e-6 * std::max(1.0, expected_variance), "the windowed variance differs");
+		}
+
+		expect(by_time > 0 && by_capacity > 0, "the windows were not cut both by time and by capacity");
+
+		std::printf("windowed statistics: %zu samples, %zu evicted by time and %zu by capacity\n", SAMPLES, by_time, by_capacity);
+	}
+
+	// Several readers of one snapshot_average: each cursor must see the average since its own previous read, whoever else reads,
+	// and a reset by one reader must neither hand the others a made up average nor take away their last one.
+	void snapshot_average_cursors()
+	{
+		snapshot_average<double> average;
+		snapshot_average<double>::cursor csv = average.open_cursor();
+		snapshot_average<double>::cursor gauge = average.open_cursor();
+
+		average.update(1.0);
+		average.update(2.0);
+		average.update(3.0);
+
+		expect(average.get(csv) == 2.0, "a cursor does not see the samples since it was opened");
+
+		average.update(5.0);
+
+		snapshot_average<double>::cursor late = average.open_cursor();
+
+		expect(average.get(csv) == 5.0, "a cursor does not start from its previous read");
+		expect(average.get(gauge) == 2.75, "a read of one cursor moved another one");
+		expect(average.get(gauge) == 2.75 && average.get(late) == 0.0, "a cursor without new samples does not keep its last average");
+		expect(average.get() == 2.75, "the built-in cursor was moved by the others");
+
+		// E.g. the built-in reader resets, while the others have read everything or nothing since
+		average.update(7.0);
+		average.reset();
+
+		expect(average.get(csv) == 5.0 && average.get(gauge) == 2.75, "a reset took the last average of the other readers");
+
+		average.update(10.0);
+		average.update(20.0);
+
+		expect(average.get(csv) == 15.0 && average.get(gauge) == 15.0 && average.get(late) == 15.0, "a reader got a made up average after a reset");
+		expect(average.get() == 15.0, "the built-in cursor does not start from the reset");
+
+		std::printf("snapshot average cursors: independent, and a reset leaves the other readers alone\n");
+	}
+
+	// One writer hammers a seqlock_property_group while several readers take snapshots for a while.
+	// Every field of a snapshot must come from the same update, and a reader must never see an older update than before.
+	void seqlock_hammer()
+	{
+		constexpr size_t READERS = 4;
+		constexpr std::chrono::milliseconds DURATION(500);
+
+		// Large enough that a reader is often preempted in the middle of a copy, even on a single core
+		struct sample
+		{
+			uint64_t fields[64];
+		};
+
+		seqlock_property_group<sample> group;
+		std::atomic<uint64_t> snapshots = 0;
+		std::atomic<uint64_t> torn = 0;
+		std::atomic<uint64_t> regressed = 0;
+		uint64_t updates = 0;
+
+		{
+			std::array<std::jthread, READERS> readers;
+
+			for (std::jthread& reader : readers)
+			{
+				reader = std::jthread([&](std::stop_token stop)
+				{
+					uint64_t previous = 0;
+
+					while (!stop.stop_requested())
+					{
+						const sample copy = group.snapshot();
+
+						if (std::any_of(std::begin(copy.fields), std::end(copy.fields), [&](uint64_t field) { return field != copy.fields[0]; }))
+						{
+							torn.fetch_add(1, std::memory_order_relaxed);
+						}
+
+						if (copy.fields[0] < previous)
+						{
+							regressed.fetch_add(1, std::memory_order_relaxed);
+						}
+
+						previous = copy.fields[0];
+						snapshots.fetch_add(1, std::memory_order_relaxed);
+					}
+				});
+			}
+
+			const auto end = std::chrono::steady_clock::now() + DURATION;
+
+			while (std::chrono::steady_clock::now() < end)
+			{
+				group.update([&](sample& data)
+				{
+					std::fill(std::begin(data.fields), std::end(data.fields), ++updates);
+				});
+			}
+		}
+
+		expect(snapshots > 0, "no snapshots were taken");
+		expect(torn == 0, "a snapshot mixed fields of different updates");
+		expect(regressed == 0, "a snapshot went back to an older update");
+
+		std::printf("seqlock hammer: %llu updates, %llu snapshots by %zu readers\n",
+			static_cast<unsigned long long>(updates), static_cast<unsigned long long>(snapshots.load()), READERS);
+	}
+}
+
+int main()
+{
+	try
+	{
+		sl::check::csv_round_trip();
+		sl::check::csv_failed_row();
+		sl::check::rollup_empty_minute();
+		sl::check::windowed_statistics();
+		sl::check::snapshot_average_cursors();
+		sl::check::seqlock_hammer();
+		sl::check::log_records();
+		sl::check::uevent_monitor();
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,381 @@
+#include "mega.pch"
+#include "sykero_alloc.hpp"
+
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+#include "sykero_log.hpp"
+
+#include <cstdlib>
+#include <execinfo.h>
+
+// Defined by the GNU linker, the text segment of the executable
+extern "C" const char __executable_start[];
+extern "C" const char etext[];
+
+namespace sl::alloc
+{
+	namespace
+	{
+		static_assert(std::has_single_bit(MAX_SITES), "MAX_SITES must be a power of two");
+
+		struct thread_slot
+		{
+			std::atomic<pid_t> tid = 0;
+			std::atomic<uint64_t> count = 0;
+		};
+
+		using site = std::array<uintptr_t, SITE_FRAMES>;
+
+		// The key is the hash of the frames, which are written once by the thread which claims the slot
+		struct site_slot
+		{
+			std::atomic<size_t> key = 0;
+			std::array<std::atomic<uintptr_t>, SITE_FRAMES> frames = {};
+			std::atomic<uint64_t> count = 0;
+		};
+
+		// Fixed arrays, because the counting itself must not allocate
+		std::array<thread_slot, MAX_THREADS> threads;
+		std::array<site_slot, MAX_SITES> sites;
+
+		std::atomic<bool> initialized = false;
+		std::atomic<uint64_t> total = 0;
+		std::atomic<uint64_t> untracked = 0;
+
+		thread_local size_t exemptions = 0;
+		thread_local bool counting = false;
+
+		thread_slot* claim_thread_slot()
+		{
+			const pid_t tid = gettid();
+
+			for (thread_slot& slot : threads)
+			{
+				pid_t expected = 0;
+
+				if (slot.tid.compare_exchange_strong(expected, tid, std::memory_order_relaxed))
+				{
+					return &slot;
+				}
+			}
+
+			return nullptr;
+		}
+
+		bool in_executable(const void* address)
+		{
+			const char* text = static_cast<const char*>(address);
+			return text >= __executable_start && text < etext;
+		}
+
+		// The frames in the executable from the caller of operator new upwards, i.e. without the frames of libstdc++ in between.
+		// The innermost frame is often an inlined std::allocator, hence the callers above it.
+		site call_site(const void* caller)
+		{
+			void* frames[STACK_DEPTH];
+			const int depth = backtrace(frames, STACK_DEPTH);
+			bool above = false;
+			site result = {};
+			size_t found = 0;
+
+			for (int i = 0; i < depth && found < SITE_FRAMES; ++i)
+			{
+				if (frames[i] == caller)
+				{
+					above = true;
+				}
+
+				if (above && in_executable(frames[i]))
+				{
+					result[found++] = reinterpret_cast<uintptr_t>(frames[i]);
+				}
+			}
+
+			return result;
+		}
+
+		site_slot* find_site_slot(const site& frames)
+		{
+			size_t key = 0;
+
+			for (uintptr_t frame : frames)
+			{
+				key = key * 31 + std::hash<uintptr_t>()(frame);
+			}
+
+			// Zero marks a free slot
+			key |= 1;
+
+			for (size_t probe = 0, index = key; probe < MAX_SITES; ++probe, ++index)
+			{
+				site_slot& slot = sites[index & (MAX_SITES - 1)];
+				size_t expected = 0;
+
+				if (slot.key.compare_exchange_strong(expected, key, std::memory_order_relaxed))
+				{
+					for (size_t i = 0; i < SITE_FRAMES; ++i)
+					{
+						slot.frames[i].store(frames[i], std::memory_order_relaxed);
+					}
+
+					return &slot;
+				}
+
+				if (expected == key)
+				{
+					return &slot;
+				}
+			}
+
+			return nullptr;
+		}
+
+		void thread_name(pid_t tid, char* name, size_t size)
+		{
+			char path[0x40];
+			std::snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+
+			name[0] = '\0';
+			const int descriptor = ::open(path, O_RDONLY | O_CLOEXEC);
+
+			if (descriptor < 0)
+			{
+				return;
+			}
+
+			const ssize_t length = ::read(descriptor, name, size - 1);
+			::close(descriptor);
+
+			name[length > 0 ? length - 1 : 0] = '\0';
+		}
+	}
+
+	void count(const void* caller)
+	{
+		if (!initialized.load(std::memory_order_relaxed) || exemptions || counting)
+		{
+			return;
+		}
+
+		// backtrace may end up here again
+		counting = true;
+
+		total.fetch_add(1, std::memory_order_relaxed);
+
+		thread_local thread_slot* const thread = claim_thread_slot();
+		site_slot* const site = find_site_slot(call_site(caller));
+
+		if (thread)
+		{
+			thread->count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (site)
+		{
+			site->count.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			untracked.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		counting = false;
+	}
+
+	void mark_initialized()
+	{
+		// The first backtrace loads the unwinder, which allocates
+		void* frames[STACK_DEPTH];
+		backtrace(frames, STACK_DEPTH);
+
+		initialized.store(true, std::memory_order_relaxed);
+
+		log_info("allocation tracking initialized.");
+	}
+
+	void mark_stopped()
+	{
+		initialized.store(false, std::memory_order_relaxed);
+	}
+
+	exemption::exemption()
+	{
+		++exemptions;
+	}
+
+	exemption::~exemption()
+	{
+		--exemptions;
+	}
+
+	uint64_t steady_state_allocations()
+	{
+		return total.load(std::memory_order_relaxed);
+	}
+
+	void report()
+	{
+		const exemption reporting;
+
+		const uint64_t allocations = total.load(std::memory_order_relaxed);
+
+		if (!allocations)
+		{
+			log_info("no allocations since initialized.");
+			return;
+		}
+
+		log_warning("%llu allocations since initialized.", static_cast<unsigned long long>(allocations));
+
+		for (const thread_slot& slot : threads)
+		{
+			const pid_t tid = slot.tid.load(std::memory_order_relaxed);
+			const uint64_t count = slot.count.load(std::memory_order_relaxed);
+
+			if (!tid || !count)
+			{
+				continue;
+			}
+
+			char name[0x20];
+			thread_name(tid, name, sizeof(name));
+
+			log_warning("thread %d %s allocated %llu times.", tid, name, static_cast<unsigned long long>(count));
+		}
+
+		const uintptr_t base = reinterpret_cast<uintptr_t>(__executable_start);
+
+		for (const site_slot& slot : sites)
+		{
+			const uint64_t count = slot.count.load(std::memory_order_relaxed);
+
+			if (!count)
+			{
+				continue;
+			}
+
+			char frames[0x80] = {};
+			size_t length = 0;
+
+			for (const std::atomic<uintptr_t>& frame : slot.frames)
+			{
+				const uintptr_t address = frame.load(std::memory_order_relaxed);
+
+				if (address && length < sizeof(frames))
+				{
+					length += std::snprintf(frames + length, sizeof(frames) - length, " 0x%zx", static_cast<size_t>(address - base));
+				}
+			}
+
+			log_warning("call site%s allocated %llu times.", frames, static_cast<unsigned long long>(count));
+		}
+
+		const uint64_t lost = untracked.load(std::memory_order_relaxed);
+
+		if (lost)
+		{
+			log_warning("%llu allocations did not fit into the call site table.", static_cast<unsigned long long>(lost));
+		}
+	}
+}
+
+namespace
+{
+	void* allocate(std::size_t size, const void* caller)
+	{
+		sl::alloc::count(caller);
+
+		if (void* memory = std::malloc(size ? size : 1))
+		{
+			return memory;
+		}
+
+		throw std::bad_alloc();
+	}
+
+	void* allocate(std::size_t size, std::align_val_t alignment, const void* caller)
+	{
+		sl::alloc::count(caller);
+
+		void* memory = nullptr;
+
+		if (posix_memalign(&memory, std::max(static_cast<size_t>(alignment), sizeof(void*)), size ? size : 1) == 0)
+		{
+			return memory;
+		}
+
+		throw std::bad_alloc();
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	return allocate(size, __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size)
+{
+	return allocate(size, __builtin_return_address(0));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	sl::alloc::count(__builtin_return_address(0));
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	sl::alloc::count(__builtin_return_address(0));
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return allocate(size, alignment, __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return allocate(size, alignment, __builtin_return_address(0));
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+#include "sykero_mem.hpp"
+
+// Replaces the global operator new with one which counts the allocations per thread and per call site once the program has initialized.
+// After the marker the scheduler ticks, the monitoring threads and the logging should not allocate at all.
+// The call sites are reported as offsets into the executable, e.g. addr2line -C -f -i -e sykerolabs 0x1234 0x5678
+namespace sl::alloc
+{
+	constexpr size_t MAX_THREADS = 32;
+	constexpr size_t MAX_SITES = 256; // Must be a power of two
+	constexpr size_t STACK_DEPTH = 12;
+	constexpr size_t SITE_FRAMES = 4; // The innermost frames in the executable which identify a call site
+
+	// From here on every allocation is counted
+	void mark_initialized();
+
+	// Until here, i.e. the shutdown may allocate
+	void mark_stopped();
+
+	// The allocations of the calling thread are not counted while this lives, e.g. for the daily CSV rotation or reopening an unplugged device
+	class exemption final
+	{
+	public:
+		exemption();
+		~exemption();
+		SL_NON_COPYABLE(exemption);
+	};
+
+	uint64_t steady_state_allocations();
+
+	// Logs the threads and the call sites which have allocated since the marker
+	void report();
+}
+#endif
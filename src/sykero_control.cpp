@@ -0,0 +1,39 @@
+#include "mega.pch"
+#include "sykero_control.hpp"
+
+namespace sl::control
+{
+	pi_controller::pi_controller(float proportional_gain, float integral_gain, float minimum, float maximum) :
+		_proportional_gain(proportional_gain),
+		_integral_gain(integral_gain),
+		_minimum(minimum),
+		_maximum(maximum)
+	{
+		if (!(minimum < maximum))
+		{
+			throw std::invalid_argument("the minimum output must be below the maximum");
+		}
+	}
+
+	float pi_controller::update(float setpoint, float measurement, float feed_forward, std::chrono::duration<float> elapsed)
+	{
+		const float error = setpoint - measurement;
+		const float proportional = feed_forward + _proportional_gain * error;
+		const float integral = _integral + _integral_gain * error * elapsed.count();
+		const float output = proportional + integral;
+
+		if ((output > _maximum && error > 0.0f) || (output < _minimum && error < 0.0f))
+		{
+			return std::clamp(proportional + _integral, _minimum, _maximum);
+		}
+
+		_integral = integral;
+
+		return std::clamp(output, _minimum, _maximum);
+	}
+
+	void pi_controller::reset()
+	{
+		_integral = 0.0f;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+
+namespace sl::control
+{
+	// A proportional-integral controller around a feed-forward term, with the output limited between the minimum and the maximum.
+	// The integral is not accumulated while the output is saturated in the direction of the error, so it does not wind up.
+	class pi_controller final
+	{
+	public:
+		pi_controller(float proportional_gain, float integral_gain, float minimum, float maximum);
+
+		SL_NON_COPYABLE(pi_controller);
+
+		float update(float setpoint, float measurement, float feed_forward, std::chrono::duration<float> elapsed);
+
+		void reset();
+
+	private:
+		const float _proportional_gain;
+		const float _integral_gain;
+		const float _minimum;
+		const float _maximum;
+		float _integral = 0.0f;
+	};
+}
@@ -4,6 +4,12 @@
 
 namespace sl::csv
 {
+	inline metrics::counter bytes_written("sykerolabs_csv_bytes_written_total", "Bytes appended to the CSV files");
+	inline metrics::histogram fsync_duration("sykerolabs_csv_fsync_microseconds", "Duration of the fsync after each CSV commit");
+
+	// The most rows which can be held back and committed at once, see file::set_commit_interval
+	constexpr size_t MAX_COMMIT_ROWS = 16;
+
 	template <size_t COLUMNS>
 	class file final : private io::file_descriptor
 	{
@@ -18,15 +24,38 @@ namespace sl::csv
 
 		SL_NON_COPYABLE(file);
 
+		~file()
+		{
+			try
+			{
+				commit();
+			}
+			catch (const std::system_error& e)
+			{
+				log_error("%zu CSV rows lost: %s", _pending_rows, e.what());
+			}
+		}
+
 		void initialize(const std::filesystem::path& path)
 		{
 			std::lock_guard<std::mutex> lock(_mutex);
 
+			// The rows held back belong to the previous file
+			commit();
+
 			file_descriptor::open(path, O_WRONLY | O_CREAT | O_APPEND);
 
-			for (auto column_name : _header)
+			try
 			{
-				append_value(column_name);
+				for (auto column_name : _header)
+				{
+					append_value(column_name);
+				}
+			}
+			catch (...)
+			{
+				discard_row();
+				throw;
 			}
 
 			const size_t file_size = file_descriptor::file_size();
@@ -34,47 +63,178 @@ namespace sl::csv
 			if (file_size == 0)
 			{
 				// An empty file, write the header
-				write_text(_row);
+				write(_row.data(), _row.size());
 			}
 			else if (file_size < _row.size())
 			{
 				// Malformed header, reopen, truncate and write header
 				file_descriptor::open(path, O_WRONLY | O_TRUNC);
-				write_text(_row);
+				write(_row.data(), _row.size());
 			}
 
 			_row.clear();
 			_current_column = 0;
+			_rows_since_keyframe = 0;
 
 			log_info("%s opened.", path.c_str());
 		}
 
+		// Switches to the change-driven mode: a column is written only when it has moved past its deadband since it was last written,
+		// and rows where nothing but the first (time) column changed are skipped. Every keyframe_interval:th row is written in full.
+		// Use csv::sparse_reader to reconstruct the dense rows.
+		void enable_deadbands(const std::array<float, COLUMNS>& deadbands, size_t keyframe_interval)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			assert(keyframe_interval > 0);
+
+			_deadbands = deadbands;
+			_keyframe_interval = keyframe_interval;
+			_rows_since_keyframe = 0;
+		}
+
+		// Writes and syncs the rows in batches, i.e. the storage is written to less often, but the batched rows are lost if the process dies
+		void set_commit_interval(size_t rows)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			assert(rows > 0 && rows <= MAX_COMMIT_ROWS);
+
+			_commit_interval = rows;
+
+			if (_pending_rows >= _commit_interval)
+			{
+				commit();
+			}
+		}
+
 		template<typename... Args>
 		void append_row(Args&&... args)
 		{
 			static_assert(sizeof...(Args) == COLUMNS, "too few arguments!");
 
+			SL_TRACE_SPAN("csv::append_row");
+
 			std::lock_guard<std::mutex> lock(_mutex);
 
-			(append_value(std::forward<Args>(args)), ...);
-			write_text(_row);
+			_keyframe = !_keyframe_interval || _rows_since_keyframe == 0;
+			_changed_columns = 0;
+
+			try
+			{
+				(append_value(std::forward<Args>(args)), ...);
+			}
+			catch (...)
+			{
+				discard_row();
+				throw;
+			}
+
+			if (_keyframe || _changed_columns > 0)
+			{
+				_pending.append(_row.data(), _row.size());
+
+				if (++_pending_rows >= _commit_interval)
+				{
+					commit();
+				}
+			}
+
+			if (_keyframe_interval && ++_rows_since_keyframe >= _keyframe_interval)
+			{
+				_rows_since_keyframe = 0;
+			}
+
 			_row.clear();
 			_current_column = 0;
-			file_descriptor::fsync();
 		}
 
 	private:
+		// Drops a row which failed half way, e.g. on a value which does not fit. The next row is a keyframe,
+		// because the failed one has already moved the last values of its first columns, but none of them were written.
+		void discard_row()
+		{
+			_row.clear();
+			_current_column = 0;
+			_rows_since_keyframe = 0;
+		}
 
+		void commit()
+		{
+			if (!_pending_rows)
+			{
+				return;
+			}
+
+			write(_pending.data(), _pending.size());
+			bytes_written.add(_pending.size());
+
+			_pending.clear();
+			_pending_rows = 0;
+
+			const auto written = std::chrono::steady_clock::now();
+			file_descriptor::fsync();
+			fsync_duration.record(std::chrono::steady_clock::now() - written);
+		}
+
+		// The first column is always written, the rest only if they have changed enough
 		template <typename T>
-		void append_value(T&& value)
+		bool has_changed(const T& value)
 		{
-			if constexpr (std::is_arithmetic_v<std::remove_reference_t<T>>)
+			const size_t column = _current_column;
+
+			if (!_keyframe_interval || column == 0)
 			{
-				_row += std::to_string(value);
+				return true;
+			}
+
+			bool changed = _keyframe;
+
+			if constexpr (std::is_arithmetic_v<std::remove_cvref_t<T>>)
+			{
+				const double current = static_cast<double>(value);
+				const double last = _last_value[column];
+
+				// A nan, e.g. of an empty minute, is as far from every number as it can be
+				if (std::isnan(current) != std::isnan(last) || std::abs(current - last) > static_cast<double>(_deadbands[column]))
+				{
+					changed = true;
+				}
+
+				if (changed)
+				{
+					_last_value[column] = current;
+				}
 			}
 			else
 			{
-				_row += value;
+				const std::string_view current(value);
+
+				if (current != _last_text[column])
+				{
+					changed = true;
+				}
+
+				if (changed)
+				{
+					_last_text[column].assign(current);
+				}
+			}
+
+			if (changed)
+			{
+				++_changed_columns;
+			}
+
+			return changed;
+		}
+
+		template <typename T>
+		void append_value(T&& value)
+		{
+			if (has_changed(value))
+			{
+				append_text(std::forward<T>(value));
 			}
 
 			if (++_current_column < COLUMNS)
@@ -87,9 +247,179 @@ namespace sl::csv
 			}
 		}
 
+		template <typename T>
+		void append_text(T&& value)
+		{
+			if constexpr (std::is_floating_point_v<std::remove_cvref_t<T>>)
+			{
+				// The same format as std::to_string, without the temporary string
+				char text[0x40];
+				const int length = std::snprintf(text, sizeof(text), "%f", static_cast<double>(value));
+				_row.append(text, std::min<size_t>(length, sizeof(text) - 1));
+			}
+			else if constexpr (std::is_arithmetic_v<std::remove_cvref_t<T>>)
+			{
+				char text[24];
+				const auto result = std::to_chars(text, text + sizeof(text), value);
+				_row.append(text, result.ptr);
+			}
+			else
+			{
+				_row += value;
+			}
+		}
+
 		std::mutex _mutex;
 		const std::array<std::string_view, COLUMNS> _header;
 		size_t _current_column = 0;
-		std::string _row;
+		// Fixed, so that a runaway value fails the row instead of growing the buffer for good
+		static constexpr size_t ROW_CAPACITY = COLUMNS * 0x20;
+		mem::fixed_string<ROW_CAPACITY> _row;
+
+		// The written rows which have not been committed yet
+		mem::fixed_string<ROW_CAPACITY * MAX_COMMIT_ROWS> _pending;
+		size_t _pending_rows = 0;
+		size_t _commit_interval = 1;
+
+		// The change-driven mode, disabled when the keyframe interval is zero
+		std::array<float, COLUMNS> _deadbands = {};
+		std::array<double, COLUMNS> _last_value = {};
+		std::array<mem::fixed_string<0x20>, COLUMNS> _last_text;
+		size_t _keyframe_interval = 0;
+		size_t _rows_since_keyframe = 0;
+		size_t _changed_columns = 0;
+		bool _keyframe = true;
+	};
+
+	// Reconstructs the dense, periodic rows of a file written in the change-driven mode.
+	// Empty fields repeat the previous value and skipped rows repeat the previous row one period later.
+	// The rows skipped after the last written row are unknown until the next row, which is at the latest the next keyframe.
+	// A longer gap means that nothing was written, e.g. the process was down, so it is left as a gap.
+	template <size_t COLUMNS>
+	class sparse_reader
+	{
+	public:
+		sparse_reader(std::chrono::seconds period, size_t keyframe_interval) :
+			_period(period),
+			_keyframe_interval(keyframe_interval)
+		{
+			assert(period.count() > 0 && keyframe_interval > 0);
+		}
+
+		// Feeds one line of the file. The emit function is called with every reconstructed line, the header is passed through as is.
+		template <typename F>
+		void feed(std::string_view line, F&& emit)
+		{
+			while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+			{
+				line.remove_suffix(1);
+			}
+
+			if (line.empty())
+			{
+				return;
+			}
+
+			if (!_header_seen)
+			{
+				_header_seen = true;
+				emit(std::string(line) + "\r\n");
+				return;
+			}
+
+			std::array<std::string_view, COLUMNS> fields;
+			size_t column = 0;
+
+			for (const auto field : std::views::split(line, ','))
+			{
+				if (column >= COLUMNS)
+				{
+					throw std::runtime_error("too many columns");
+				}
+
+				fields[column++] = std::string_view(field.begin(), field.end());
+			}
+
+			if (column != COLUMNS)
+			{
+				throw std::runtime_error("too few columns");
+			}
+
+			const std::time_t time = parse_time(fields[0]);
+
+			if (_previous_time && time - _previous_time <= _period.count() * static_cast<std::time_t>(_keyframe_interval))
+			{
+				// Rows that were skipped because nothing changed
+				for (std::time_t t = _previous_time + _period.count(); t < time; t += _period.count())
+				{
+					_values[0] = format_time(t);
+					emit(join());
+				}
+			}
+
+			for (size_t i = 0; i < COLUMNS; ++i)
+			{
+				if (!fields[i].empty())
+				{
+					_values[i] = fields[i];
+				}
+			}
+
+			_previous_time = time;
+			emit(join());
+		}
+
+	private:
+		static std::time_t parse_time(std::string_view text)
+		{
+			const std::string copy(text);
+
+			std::tm tm;
+			mem::clear(tm);
+
+			if (!strptime(copy.c_str(), "%FT%T", &tm))
+			{
+				throw std::runtime_error("strptime");
+			}
+
+			tm.tm_isdst = -1;
+
+			return std::mktime(&tm);
+		}
+
+		static std::string format_time(std::time_t time)
+		{
+			std::tm tm;
+			mem::clear(tm);
+
+			if (!localtime_r(&time, &tm))
+			{
+				throw std::runtime_error("localtime_r");
+			}
+
+			char text[0x20];
+			const size_t size = std::strftime(text, sizeof(text), "%FT%T", &tm);
+
+			return std::string(text, size);
+		}
+
+		std::string join() const
+		{
+			std::string result;
+
+			for (size_t i = 0; i < COLUMNS; ++i)
+			{
+				result += _values[i];
+				result += i + 1 < COLUMNS ? "," : "\r\n";
+			}
+
+			return result;
+		}
+
+		const std::chrono::seconds _period;
+		const size_t _keyframe_interval;
+		bool _header_seen = false;
+		std::time_t _previous_time = 0;
+		std::array<std::string, COLUMNS> _values;
 	};
 }
\ No newline at end of file
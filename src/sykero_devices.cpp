@@ -0,0 +1,161 @@
+#include "mega.pch"
+#include "sykero_devices.hpp"
+#include "sykero_log.hpp"
+
+namespace sl::devices
+{
+	namespace
+	{
+		template <typename F>
+		bool reopen_device(const iio_devices& devices, const char* name, F&& open)
+		{
+			try
+			{
+				open(find_iio_device(devices, name));
+				return true;
+			}
+			catch (const std::exception& e)
+			{
+				log_warning("IIO device %s not reopened: %s.", name, e.what());
+				return false;
+			}
+		}
+	}
+
+	iio_devices index_iio_devices(const std::filesystem::path& prefix)
+	{
+		const std::string name_prefix = prefix.filename();
+		std::string name_buffer(0x80, '\0');
+		iio_devices devices;
+
+		for (const auto& entry : std::filesystem::directory_iterator(prefix.parent_path()))
+		{
+			if (!entry.path().filename().native().starts_with(name_prefix))
+			{
+				continue;
+			}
+
+			// A device which is going away is skipped, so that the others can still be found
+			try
+			{
+				io::file_descriptor device_name_file(entry.path() / "name");
+
+				size_t bytes_read = device_name_file.read_text(name_buffer);
+
+				if (bytes_read)
+				{
+					devices.emplace_back(name_buffer.substr(0, bytes_read - 1), entry.path());
+				}
+			}
+			catch (const std::system_error& e)
+			{
+				log_debug("IIO device skipped: %s.", e.what());
+			}
+		}
+
+		return devices;
+	}
+
+	std::filesystem::path find_iio_device(const iio_devices& devices, const std::string_view expected_name)
+	{
+		for (const auto& [name, path] : devices)
+		{
+			if (name == expected_name)
+			{
+				return path;
+			}
+		}
+
+		const std::string error_message =
+			std::format("Device {} not found in /sys/bus/iio/devices/iio:device*", expected_name);
+
+		throw std::runtime_error(error_message);
+	}
+
+	sensor_files::sensor_files(const std::filesystem::path& cpu_temperature_path, const std::filesystem::path& iio_prefix) :
+		cpu_temperature_path(cpu_temperature_path),
+		iio_prefix(iio_prefix)
+	{
+		const iio_devices devices = index_iio_devices(iio_prefix);
+
+		cpu_temperature.open(cpu_temperature_path, O_RDONLY);
+		open_bme680(find_iio_device(devices, "bme680"));
+		open_ads1115(find_iio_device(devices, "ads1015")); // ADS1015 and ADS1115 use the same driver
+	}
+
+	bool sensor_files::reopen()
+	{
+		const iio_devices devices = index_iio_devices(iio_prefix);
+
+		cpu_temperature.open(cpu_temperature_path, O_RDONLY);
+
+		const bool bme680 = reopen_device(devices, "bme680", [this](const std::filesystem::path& path)
+		{
+			open_bme680(path);
+		});
+
+		const bool ads1115 = reopen_device(devices, "ads1015", [this](const std::filesystem::path& path)
+		{
+			open_ads1115(path);
+		});
+
+		return bme680 && ads1115;
+	}
+
+	void sensor_files::open_bme680(const std::filesystem::path& path)
+	{
+		air_temperature.open(path / "in_temp_input", O_RDONLY);
+		air_humidity.open(path / "in_humidityrelative_input", O_RDONLY);
+		air_pressure.open(path / "in_pressure_input", O_RDONLY);
+	}
+
+	void sensor_files::open_ads1115(const std::filesystem::path& path)
+	{
+		pool1_ec.open(path / "in_voltage0_raw", O_RDONLY);
+		pool2_ec.open(path / "in_voltage1_raw", O_RDONLY);
+	}
+
+	bool supervise(uevent::monitor& uevents, sensor_files& sensors)
+	{
+		bool iio_added = false;
+		bool tty_added = false;
+		uevent::event event;
+
+		while (uevents.receive(event))
+		{
+			const bool lost = event.action == uevent::ACTION_LOST;
+
+			if (!lost && event.subsystem != "iio" && event.subsystem != "tty")
+			{
+				continue;
+			}
+
+			log_info("uevent %.*s %.*s.",
+				static_cast<int>(event.action.size()), event.action.data(),
+				static_cast<int>(event.devpath.size()), event.devpath.data());
+
+			iio_added |= lost || (event.subsystem == "iio" && event.action == "add");
+			tty_added |= lost || (event.subsystem == "tty" && event.action == "add");
+		}
+
+		if (iio_added)
+		{
+			const auto started = std::chrono::steady_clock::now();
+
+			try
+			{
+				if (sensors.reopen())
+				{
+					const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+					log_notice("IIO devices reopened in %lld us.", static_cast<long long>(elapsed.count()));
+				}
+			}
+			catch (const std::exception& e)
+			{
+				log_warning("IIO devices not reopened: %s.", e.what());
+			}
+		}
+
+		return tty_added;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sykero_io.hpp"
+#include "sykero_uevent.hpp"
+
+namespace sl::devices
+{
+	using iio_devices = std::vector<std::pair<std::string, std::filesystem::path>>;
+
+	// Reads the name of every IIO device at once, instead of probing each possible index for each device.
+	// The prefix is the path of a device without its index, e.g. paths::IIO_DEVICE.
+	iio_devices index_iio_devices(const std::filesystem::path& prefix);
+
+	std::filesystem::path find_iio_device(const iio_devices& devices, std::string_view expected_name);
+
+	// The sysfs attributes sampled by the scheduler
+	struct sensor_files
+	{
+		// At startup every sensor must be present
+		sensor_files(const std::filesystem::path& cpu_temperature_path, const std::filesystem::path& iio_prefix);
+
+		// In place, so that the references to the descriptors stay valid, e.g. when a sensor has come back to the bus as another device.
+		// Each device is reopened by itself, so that one which is back is read again while the other one is still missing.
+		// Returns whether both were reopened.
+		bool reopen();
+
+		void open_bme680(const std::filesystem::path& path);
+		void open_ads1115(const std::filesystem::path& path);
+
+		const std::filesystem::path cpu_temperature_path;
+		const std::filesystem::path iio_prefix;
+
+		io::file_descriptor cpu_temperature;
+		io::file_descriptor air_temperature;
+		io::file_descriptor air_humidity;
+		io::file_descriptor air_pressure;
+		io::file_descriptor pool1_ec;
+		io::file_descriptor pool2_ec;
+	};
+
+	// Reopens the sensors when the kernel reports them back, while everything else keeps running.
+	// Returns whether a tty was added, i.e. whether the serial port should be reopened too.
+	bool supervise(uevent::monitor& uevents, sensor_files& sensors);
+}
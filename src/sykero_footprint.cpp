@@ -0,0 +1,170 @@
+#include "mega.pch"
+#include "sykero_footprint.hpp"
+#include "sykero_log.hpp"
+#include "sykero_metrics.hpp"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+namespace sl::footprint
+{
+	namespace
+	{
+		metrics::gauge resident_bytes("sykerolabs_resident_bytes", "Resident set size of the process");
+		metrics::gauge peak_resident_bytes("sykerolabs_peak_resident_bytes", "Peak resident set size of the process");
+
+		struct thread_stack
+		{
+			const char* name = nullptr;
+			pid_t tid = 0;
+			uintptr_t low = 0;
+			size_t size = 0;
+		};
+
+		std::mutex threads_mutex;
+		std::array<thread_stack, MAX_THREADS> threads;
+		size_t thread_count = 0;
+
+		// A stack grows down from its top and its pages stay resident once touched, so the resident pages are its high-water mark.
+		// This does not touch the stack itself, unlike painting it with a pattern.
+		size_t resident_pages(uintptr_t low, size_t size)
+		{
+			const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			unsigned char residency[0x100];
+			size_t resident = 0;
+
+			for (size_t offset = 0; offset < size; offset += sizeof(residency) * page_size)
+			{
+				const size_t length = std::min(size - offset, sizeof(residency) * page_size);
+				const size_t pages = (length + page_size - 1) / page_size;
+
+				if (mincore(reinterpret_cast<void*>(low + offset), length, residency) == 0)
+				{
+					for (size_t i = 0; i < pages; ++i)
+					{
+						resident += residency[i] & 1;
+					}
+
+					continue;
+				}
+
+				// The main thread stack is reported up to its rlimit, but only the part it has grown to is mapped
+				for (size_t i = 0; i < pages; ++i)
+				{
+					if (mincore(reinterpret_cast<void*>(low + offset + i * page_size), page_size, residency) == 0)
+					{
+						resident += residency[0] & 1;
+					}
+				}
+			}
+
+			return resident * page_size;
+		}
+	}
+
+	void limit_thread_stacks(size_t size)
+	{
+		pthread_attr_t attributes;
+		pthread_attr_init(&attributes);
+
+		int result = pthread_attr_setstacksize(&attributes, size);
+
+		if (result == 0)
+		{
+			result = pthread_setattr_default_np(&attributes);
+		}
+
+		pthread_attr_destroy(&attributes);
+
+		if (result != 0)
+		{
+			throw std::system_error(result, std::system_category(), "pthread_setattr_default_np");
+		}
+	}
+
+	void register_thread(const char* name)
+	{
+		pthread_attr_t attributes;
+
+		if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+		{
+			return;
+		}
+
+		void* low = nullptr;
+		size_t size = 0;
+		pthread_attr_getstack(&attributes, &low, &size);
+		pthread_attr_destroy(&attributes);
+
+		std::lock_guard<std::mutex> lock(threads_mutex);
+
+		if (thread_count < MAX_THREADS)
+		{
+			threads[thread_count++] = { name, gettid(), reinterpret_cast<uintptr_t>(low), size };
+		}
+	}
+
+	size_t resident_size()
+	{
+		size_t total_pages = 0;
+		size_t resident = 0;
+
+		FILE* statm = std::fopen("/proc/self/statm", "r");
+
+		if (!statm)
+		{
+			return 0;
+		}
+
+		if (std::fscanf(statm, "%zu %zu", &total_pages, &resident) != 2)
+		{
+			resident = 0;
+		}
+
+		std::fclose(statm);
+
+		return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+
+	size_t peak_resident_size()
+	{
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+
+		return static_cast<size_t>(usage.ru_maxrss) * 1024;
+	}
+
+	bool report(size_t budget)
+	{
+		const size_t resident = resident_size();
+		const size_t peak = peak_resident_size();
+
+		resident_bytes.set(static_cast<double>(resident));
+		peak_resident_bytes.set(static_cast<double>(peak));
+
+		log_info("resident %zu KiB, peak %zu KiB of the %zu KiB budget.", resident / 1024, peak / 1024, budget / 1024);
+
+		{
+			std::lock_guard<std::mutex> lock(threads_mutex);
+
+			for (size_t i = 0; i < thread_count; ++i)
+			{
+				const thread_stack& stack = threads[i];
+
+				log_info("thread %d %s stack high-water %zu KiB of %zu KiB.",
+					stack.tid,
+					stack.name,
+					resident_pages(stack.low, stack.size) / 1024,
+					stack.size / 1024);
+			}
+		}
+
+		if (peak > budget)
+		{
+			log_warning("peak resident size %zu KiB is over the %zu KiB budget.", peak / 1024, budget / 1024);
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+
+// Where the memory of the process goes: the resident size against a budget, and how deep each thread stack has actually been used
+namespace sl::footprint
+{
+	constexpr size_t MAX_THREADS = 16;
+
+	// Sets the stack size of the threads created after this, including the ones std::jthread creates
+	void limit_thread_stacks(size_t size);
+
+	// Remembers the stack of the calling thread, so that its high-water mark can be reported
+	void register_thread(const char* name);
+
+	size_t resident_size();
+	size_t peak_resident_size();
+
+	// Logs the resident size and the stack high-water marks. Returns false if the peak has exceeded the budget.
+	bool report(size_t budget);
+}
@@ -3,40 +3,84 @@
 #include "sykero_gpio.hpp"
 #include "sykero_log.hpp"
 
+#ifdef SYKEROLABS_SIMULATION
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 namespace sl::gpio
 {
-	line_group::line_group(int descriptor, const std::set<uint32_t>& offsets) :
-		file_descriptor(descriptor),
-		_offsets(offsets)
+	namespace
 	{
-		log_info("gpio::line_group %p opened.", this);
+		// The line offsets fit into the 64 bit masks of the GPIO v2 interface
+		metrics::counter_array<64> line_events("sykerolabs_gpio_events_total", "GPIO edge events read", "line");
 	}
 
-	line_group::~line_group()
+	size_t index_of(const std::set<uint32_t>& offsets, uint32_t offset)
 	{
-		log_info("gpio::line_group %p closed.", this);
+		auto iter = offsets.find(offset);
+
+		if (iter == offsets.cend())
+		{
+			throw std::invalid_argument("offset not found");
+		}
+
+		return std::distance(offsets.cbegin(), iter);
 	}
 
-	void line_group::read_values(std::span<line_value_pair> data) const
+	gpio_v2_line_values line_values(const std::set<uint32_t>& offsets, std::span<const line_value_pair> data)
 	{
-		assert(data.size() <= _offsets.size());
-
 		std::bitset<64> mask;
 		std::bitset<64> bits;
 
 		for (const line_value_pair& lvp : data)
 		{
-			size_t i = index_of(lvp.offset);
+			size_t i = index_of(offsets, lvp.offset);
 			mask.set(i, true);
+			bits.set(i, lvp.value);
 		}
 
-		gpio_v2_line_values values = { 0, mask.to_ullong() };
+		return { bits.to_ullong(), mask.to_ullong() };
+	}
+
+#ifdef SYKEROLABS_SIMULATION
+	std::filesystem::path simulated_event_socket(const std::filesystem::path& chip, uint32_t first_offset)
+	{
+		return chip.string() + "-line" + std::to_string(first_offset) + ".sock";
+	}
+#endif
+
+	line_group::line_group(int descriptor, const std::set<uint32_t>& offsets, const gpio_v2_line_config& config) :
+		file_descriptor(descriptor),
+		_offsets(offsets),
+		_config(config)
+	{
+		log_info("gpio::line_group %p opened.", static_cast<void*>(this));
+	}
+
+	line_group::~line_group()
+	{
+		log_info("gpio::line_group %p closed.", static_cast<void*>(this));
+	}
+
+	void line_group::read_values(std::span<line_value_pair> data) const
+	{
+		assert(data.size() <= _offsets.size());
+
+		gpio_v2_line_values values = line_values(_offsets, data);
+		values.bits = 0;
+
+#ifdef SYKEROLABS_SIMULATION
+		values.bits = _simulated_bits.load(std::memory_order_relaxed) & values.mask;
+#else
 		file_descriptor::ioctl(GPIO_V2_LINE_GET_VALUES_IOCTL, &values);
-		bits = values.bits;
+#endif
+
+		const std::bitset<64> bits = values.bits;
 
 		for (line_value_pair& lvp : data)
 		{
-			size_t i = index_of(lvp.offset);
+			size_t i = index_of(_offsets, lvp.offset);
 			lvp.value = bits[i];
 		}
 	}
@@ -50,25 +94,44 @@ namespace sl::gpio
 
 	bool line_group::read_event(gpio_v2_line_event& event) const
 	{
-		return file_descriptor::read_value(event);
+		if (!file_descriptor::read_value(event))
+		{
+			return false;
+		}
+
+#ifdef SYKEROLABS_SIMULATION
+		// So that reading the values agrees with the edges
+		const uint64_t bit = uint64_t(1) << index_of(_offsets, event.offset);
+
+		if (event.id == GPIO_V2_LINE_EVENT_RISING_EDGE)
+		{
+			_simulated_bits.fetch_or(bit, std::memory_order_relaxed);
+		}
+		else
+		{
+			_simulated_bits.fetch_and(~bit, std::memory_order_relaxed);
+		}
+#endif
+
+		line_events.increment(event.offset % 64);
+		return true;
 	}
 
 	void line_group::write_values(std::span<const line_value_pair> data) const
 	{
 		assert(data.size() <= _offsets.size());
 
-		std::bitset<64> mask;
-		std::bitset<64> bits;
+		gpio_v2_line_values values = line_values(_offsets, data);
 
-		for (const line_value_pair& lvp : data)
+#ifdef SYKEROLABS_SIMULATION
+		uint64_t bits = _simulated_bits.load(std::memory_order_relaxed);
+
+		while (!_simulated_bits.compare_exchange_weak(bits, (bits & ~values.mask) | (values.bits & values.mask), std::memory_order_relaxed))
 		{
-			size_t i = index_of(lvp.offset);
-			mask.set(i, true);
-			bits.set(i, lvp.value);
 		}
-
-		gpio_v2_line_values values = { bits.to_ullong(), mask.to_ullong() };
+#else
 		file_descriptor::ioctl(GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+#endif
 	}
 
 	void line_group::write_value(const line_value_pair& lvp) const
@@ -77,27 +140,59 @@ namespace sl::gpio
 		write_values(data);
 	}
 
-	size_t line_group::index_of(uint32_t offset) const
+	void line_group::detect_edges(bool enabled)
 	{
-		auto iter = std::find(_offsets.cbegin(), _offsets.cend(), offset);
+		constexpr uint64_t EDGES = GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
 
-		if (iter == _offsets.cend())
+		if (!(_config.flags & EDGES))
 		{
-			throw std::invalid_argument("offset not found");
+			throw std::logic_error("the lines were not requested with edge detection");
+		}
+
+#ifdef SYKEROLABS_SIMULATION
+		// A datagram socket connected to itself refuses the datagrams from anyone else, i.e. the environment gets EPERM instead of sending an edge
+		sockaddr_un address = {};
+		socklen_t length = sizeof(address);
+
+		if (enabled)
+		{
+			address.sun_family = AF_UNSPEC;
+		}
+		else if (getsockname(descriptor(), reinterpret_cast<sockaddr*>(&address), &length) != 0)
+		{
+			throw std::system_error(errno, std::system_category(), "getsockname");
+		}
+
+		if (connect(descriptor(), reinterpret_cast<const sockaddr*>(&address), length) != 0)
+		{
+			throw std::system_error(errno, std::system_category(), "connect");
+		}
+#else
+		gpio_v2_line_config config = _config;
+
+		if (!enabled)
+		{
+			config.flags &= ~EDGES;
 		}
 
-		return std::distance(_offsets.cbegin(), iter);
+		file_descriptor::ioctl(GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+#endif
+
+		log_info("gpio::line_group %p edge detection %s.", static_cast<void*>(this), enabled ? "enabled" : "disabled");
 	}
 
 	chip::chip(const std::filesystem::path& path) :
 		file_descriptor(path)
+#ifdef SYKEROLABS_SIMULATION
+		, _path(path)
+#endif
 	{
-		log_info("gpio::chip %p opened. Path: %s", this, path.c_str());
+		log_info("gpio::chip %p opened. Path: %s", static_cast<void*>(this), path.c_str());
 	}
 
 	chip::~chip()
 	{
-		log_info("gpio::chip %p closed.", this);
+		log_info("gpio::chip %p closed.", static_cast<void*>(this));
 	}
 
 	gpio::line_group chip::line_group(
@@ -133,8 +228,38 @@ namespace sl::gpio
 		mem::clone(offsets, request.offsets);
 		mem::clone("sykerolabs", request.consumer);
 
+#ifdef SYKEROLABS_SIMULATION
+		if (flags & (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING))
+		{
+			// The environment sends the edges as datagrams of gpio_v2_line_event, i.e. reading one is like reading the line request
+			const std::string socket_path = simulated_event_socket(_path, *offsets.begin()).string();
+
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+			request.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+			unlink(socket_path.c_str());
+
+			if (request.fd < 0 || bind(request.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				throw std::system_error(errno, std::system_category(), socket_path);
+			}
+		}
+		else
+		{
+			// Output lines have no events, an eventfd which is never signaled
+			request.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+			if (request.fd < 0)
+			{
+				throw std::system_error(errno, std::system_category(), "eventfd");
+			}
+		}
+#else
 		file_descriptor::ioctl(GPIO_V2_GET_LINE_IOCTL, &request);
+#endif
 
-		return gpio::line_group(request.fd, offsets);
+		return gpio::line_group(request.fd, offsets, config);
 	}
 }
\ No newline at end of file
@@ -26,10 +26,21 @@ namespace sl::gpio
 		bool value;
 	};
 
+	// The index of the line among the requested offsets, which is also its bit in the masks of the GPIO v2 interface
+	size_t index_of(const std::set<uint32_t>& offsets, uint32_t offset);
+
+	// Builds the value bits and the mask of the given lines for GPIO_V2_LINE_[GS]ET_VALUES_IOCTL
+	gpio_v2_line_values line_values(const std::set<uint32_t>& offsets, std::span<const line_value_pair> data);
+
+#ifdef SYKEROLABS_SIMULATION
+	// The simulated edge events of a line group are gpio_v2_line_event datagrams sent to this socket, named after the first line of the group
+	std::filesystem::path simulated_event_socket(const std::filesystem::path& chip, uint32_t first_offset);
+#endif
+
 	class line_group final : private io::file_descriptor
 	{
 	public:
-		line_group(int descriptor, const std::set<uint32_t>& offsets);
+		line_group(int descriptor, const std::set<uint32_t>& offsets, const gpio_v2_line_config& config);
 		SL_NON_COPYABLE(line_group);
 		~line_group();
 
@@ -40,16 +51,23 @@ namespace sl::gpio
 		void write_values(std::span<const line_value_pair> data) const;
 		void write_value(const line_value_pair& lvp) const;
 
-		template <typename Rep, typename Period>
-		bool poll(std::chrono::duration<Rep, Period> time) const
+		// Turns the edge detection of the lines off and back on, e.g. to stop the interrupts of a signal which is not needed for a while.
+		// The lines stay requested with their other flags.
+		void detect_edges(bool enabled);
+
+		// Blocks until an edge event is queued or the interrupt becomes readable, e.g. a stop_event once the stop is requested
+		inline bool poll(const io::file_descriptor& interrupt) const
 		{
-			return file_descriptor::poll(time, POLLIN | POLLPRI);
+			return file_descriptor::poll(io::INFINITE, POLLIN | POLLPRI, interrupt);
 		}
 
 	private:
-		size_t index_of(uint32_t offset) const;
-
 		std::set<uint32_t> _offsets;
+		const gpio_v2_line_config _config;
+#ifdef SYKEROLABS_SIMULATION
+		// The simulated lines only remember what was written to them
+		mutable std::atomic<uint64_t> _simulated_bits = 0;
+#endif
 	};
 
 	class chip final : public io::file_descriptor
@@ -63,6 +81,11 @@ namespace sl::gpio
 			uint64_t flags,
 			const std::set<uint32_t>& offsets,
 			std::chrono::microseconds debounce = std::chrono::microseconds(0)) const;
+
+#ifdef SYKEROLABS_SIMULATION
+	private:
+		std::filesystem::path _path;
+#endif
 	};
 
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 
 namespace sl::io
 {
+	metrics::counter ioctl_count("sykerolabs_ioctls_total", "ioctl calls issued");
+	metrics::counter sysfs_read_errors("sykerolabs_sysfs_read_errors_total", "Failed or empty reads of sysfs attributes");
+
 	file_descriptor::file_descriptor(int descriptor) :
 		_descriptor(descriptor)
 	{
@@ -42,6 +45,8 @@ namespace sl::io
 
 	void file_descriptor::open(const std::filesystem::path& path, int flags)
 	{
+		SL_TRACE_SPAN("io::open");
+
 		file_descriptor::close();
 
 		if ((flags & O_CREAT) == O_CREAT)
@@ -64,6 +69,8 @@ namespace sl::io
 
 	size_t file_descriptor::read(void* data, size_t size) const
 	{
+		SL_TRACE_SPAN("io::read");
+
 		int result = ::read(_descriptor, data, size);
 
 		if (result < 0)
@@ -76,6 +83,8 @@ namespace sl::io
 
 	void file_descriptor::write(const void* data, size_t size) const
 	{
+		SL_TRACE_SPAN("io::write");
+
 		int result = ::write(_descriptor, data, size);
 
 		if (result < 0)
@@ -104,6 +113,8 @@ namespace sl::io
 
 	off_t file_descriptor::lseek(off_t offset, int whence) const
 	{
+		SL_TRACE_SPAN("io::lseek");
+
 		off_t result = ::lseek(_descriptor, offset, whence);
 
 		if (result < 0)
@@ -116,6 +127,8 @@ namespace sl::io
 
 	struct stat file_descriptor::fstat() const
 	{
+		SL_TRACE_SPAN("io::fstat");
+
 		struct stat buffer;
 		mem::clear(buffer);
 
@@ -129,6 +142,8 @@ namespace sl::io
 
 	void file_descriptor::fsync() const
 	{
+		SL_TRACE_SPAN("io::fsync");
+
 		if (!S_ISREG(_mode))
 		{
 			return;
@@ -142,6 +157,8 @@ namespace sl::io
 
 	struct termios file_descriptor::tcgetattr() const
 	{
+		SL_TRACE_SPAN("io::tcgetattr");
+
 		struct termios options;
 		mem::clear(options);
 
@@ -155,6 +172,8 @@ namespace sl::io
 
 	void file_descriptor::tcsetattr(const struct termios& options, int actions) const
 	{
+		SL_TRACE_SPAN("io::tcsetattr");
+
 		if (::tcsetattr(_descriptor, actions, &options) < 0)
 		{
 			throw std::system_error(errno, std::system_category(), "tcsetattr");
@@ -163,14 +182,38 @@ namespace sl::io
 
 	void file_descriptor::tcflush(int queue_selector) const
 	{
+		SL_TRACE_SPAN("io::tcflush");
+
 		if (::tcflush(_descriptor, queue_selector) < 0)
 		{
 			throw std::system_error(errno, std::system_category(), "tcflush");
 		}
 	}
 
+	void file_descriptor::timerfd_settime(int flags, const itimerspec& spec) const
+	{
+		SL_TRACE_SPAN("io::timerfd_settime");
+
+		if (::timerfd_settime(_descriptor, flags, &spec, nullptr) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "timerfd_settime");
+		}
+	}
+
+	void file_descriptor::inotify_add_watch(const std::filesystem::path& path, uint32_t mask) const
+	{
+		SL_TRACE_SPAN("io::inotify_add_watch");
+
+		if (::inotify_add_watch(_descriptor, path.c_str(), mask) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), path.c_str());
+		}
+	}
+
 	void file_descriptor::close()
 	{
+		SL_TRACE_SPAN("io::close");
+
 		if (_descriptor <= 0)
 		{
 			return;
@@ -187,4 +230,66 @@ namespace sl::io
 			throw std::system_error(errno, std::system_category(), "close");
 		}
 	}
-}
\ No newline at end of file
+
+	file_watcher::file_watcher() :
+		file_descriptor(inotify_init1(IN_CLOEXEC))
+	{
+	}
+
+	void file_watcher::watch(const std::filesystem::path& path, uint32_t mask) const
+	{
+		file_descriptor::inotify_add_watch(path, mask);
+	}
+
+	stop_event::stop_event(std::stop_token stop_token) :
+		file_descriptor(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+		_stop_token(stop_token),
+		_callback(_stop_token, eventfd_signal(descriptor()))
+	{
+	}
+
+	void eventfd_signal::operator()() const noexcept
+	{
+		// A stop_event never reads the counter back, so its descriptor stays readable
+		const uint64_t one = 1;
+		[[maybe_unused]] ssize_t written = ::write(descriptor, &one, sizeof(one));
+	}
+
+	wakeup_event::wakeup_event(std::stop_token stop_token) :
+		file_descriptor(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+		_stop_token(stop_token),
+		_callback(_stop_token, eventfd_signal(descriptor()))
+	{
+	}
+
+	void wakeup_event::signal() const noexcept
+	{
+		const eventfd_signal wake{ descriptor() };
+		wake();
+	}
+
+	void wakeup_event::consume() const
+	{
+		uint64_t count = 0;
+
+		// Nonblocking, EAGAIN means there was nothing to consume
+		if (::read(descriptor(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+		{
+			throw std::system_error(errno, std::system_category(), "read");
+		}
+	}
+
+	bool file_watcher::wait(std::chrono::milliseconds timeout) const
+	{
+		if (timeout <= std::chrono::milliseconds(0) || !file_descriptor::poll(timeout, POLLIN))
+		{
+			return false;
+		}
+
+		// Every queued event fits, and none of them are interesting by themselves
+		alignas(inotify_event) char events[0x400];
+		file_descriptor::read(events, sizeof(events));
+
+		return true;
+	}
+}
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "sykero_mem.hpp"
+#include "sykero_metrics.hpp"
+#include "sykero_trace.hpp"
 
 namespace sl::io
 {
+	extern metrics::counter ioctl_count;
+	extern metrics::counter sysfs_read_errors;
+
 	class file_descriptor
 	{
 	public:
@@ -57,12 +62,21 @@ namespace sl::io
 
 		void reposition(off_t offset) const;
 
+		// For polling it together with other descriptors
+		int descriptor() const
+		{
+			return _descriptor;
+		}
+
 	protected:
 		off_t lseek(off_t offset, int whence) const;
 
 		template<typename... Args>
 		int ioctl(uint32_t request, Args... args) const
 		{
+			SL_TRACE_SPAN("io::ioctl");
+			ioctl_count.increment();
+
 			int result = ::ioctl(_descriptor, request, args...);
 
 			if (result < 0)
@@ -76,6 +90,8 @@ namespace sl::io
 		template<typename Rep, typename Period>
 		bool poll(std::chrono::duration<Rep, Period> timeout, uint16_t events) const
 		{
+			SL_TRACE_SPAN("io::poll");
+
 			pollfd poll_descriptor;
 			poll_descriptor.fd = _descriptor;
 			poll_descriptor.events = events;
@@ -93,6 +109,38 @@ namespace sl::io
 			return result > 0;
 		}
 
+		// As above, but also returns false as soon as the interrupt descriptor becomes readable
+		template<typename Rep, typename Period>
+		bool poll(std::chrono::duration<Rep, Period> timeout, uint16_t events, const file_descriptor& interrupt) const
+		{
+			SL_TRACE_SPAN("io::poll");
+
+			pollfd poll_descriptors[2];
+			poll_descriptors[0].fd = _descriptor;
+			poll_descriptors[0].events = events;
+			poll_descriptors[0].revents = 0;
+			poll_descriptors[1].fd = interrupt._descriptor;
+			poll_descriptors[1].events = POLLIN;
+			poll_descriptors[1].revents = 0;
+
+			int ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count();
+
+			int result = ::poll(poll_descriptors, 2, ms);
+
+			if (result < 0)
+			{
+				// E.g. SIGUSR1, the stop arrives through the interrupt
+				if (errno == EINTR)
+				{
+					return false;
+				}
+
+				throw std::system_error(errno, std::system_category(), "poll");
+			}
+
+			return result > 0 && poll_descriptors[1].revents == 0 && poll_descriptors[0].revents != 0;
+		}
+
 		struct stat fstat() const;
 
 		void fsync() const;
@@ -103,6 +151,10 @@ namespace sl::io
 
 		void tcflush(int queue_selector) const;
 
+		void timerfd_settime(int flags, const itimerspec& spec) const;
+
+		void inotify_add_watch(const std::filesystem::path& path, uint32_t mask) const;
+
 	private:
 		int _descriptor = 0;
 		__mode_t _mode = 0;
@@ -110,20 +162,114 @@ namespace sl::io
 		void close();
 	};
 
-	template <size_t N = 32>
-	inline std::string peek_some(const io::file_descriptor& file)
+	// Tells that something has changed in the watched paths, but not what. The caller checks that by itself.
+	class file_watcher final : private file_descriptor
 	{
-		char buffer[N];
+	public:
+		file_watcher();
+
+		SL_NON_COPYABLE(file_watcher);
+
+		void watch(const std::filesystem::path& path, uint32_t mask) const;
+
+		// Returns false if nothing changed within the timeout
+		bool wait(std::chrono::milliseconds timeout) const;
+	};
+
+	// Makes an eventfd readable, also from a stop callback
+	struct eventfd_signal
+	{
+		int descriptor;
+
+		void operator()() const noexcept;
+	};
+
+	// An eventfd which becomes readable once the stop is requested and stays readable from then on.
+	// Every blocking poll includes it, so the waits need no timeouts just to notice the stop.
+	class stop_event final : public file_descriptor
+	{
+	public:
+		explicit stop_event(std::stop_token stop_token);
 
-		size_t bytes_read = file.read_text(buffer);
+		SL_NON_COPYABLE(stop_event);
+
+		inline bool stop_requested() const
+		{
+			return _stop_token.stop_requested();
+		}
+
+		inline const std::stop_token& token() const
+		{
+			return _stop_token;
+		}
+
+	private:
+		std::stop_token _stop_token;
+
+		// Runs in whichever thread requests the stop
+		std::stop_callback<eventfd_signal> _callback;
+	};
+
+	// As stop_event, but another thread may also signal it, e.g. to have the polling thread look at a flag.
+	// The polling thread consumes the signals and checks for the stop afterwards, so that the stop is never lost.
+	class wakeup_event final : public file_descriptor
+	{
+	public:
+		explicit wakeup_event(std::stop_token stop_token);
+
+		SL_NON_COPYABLE(wakeup_event);
+
+		inline bool stop_requested() const
+		{
+			return _stop_token.stop_requested();
+		}
+
+		void signal() const noexcept;
+
+		// The descriptor stays unreadable until the next signal
+		void consume() const;
+
+	private:
+		std::stop_token _stop_token;
+
+		// Runs in whichever thread requests the stop
+		std::stop_callback<eventfd_signal> _callback;
+	};
+
+	// Blocks until the event happens
+	constexpr std::chrono::milliseconds INFINITE(-1);
+
+	// Reads into the caller's buffer, so that sampling a sysfs attribute does not allocate
+	template <size_t N>
+	inline std::string_view peek_some(const io::file_descriptor& file, char(&buffer)[N])
+	{
+		size_t bytes_read = 0;
+
+		try
+		{
+			bytes_read = file.read_text(buffer);
+		}
+		catch (const std::system_error&)
+		{
+			sysfs_read_errors.increment();
+			throw;
+		}
 
 		if (!bytes_read)
 		{
+			sysfs_read_errors.increment();
 			throw std::runtime_error("no data");
 		}
 
 		file.reposition(0);
 
-		return std::string(buffer, bytes_read);
+		return std::string_view(buffer, bytes_read);
+	}
+
+	template <size_t N = 32>
+	inline std::string peek_some(const io::file_descriptor& file)
+	{
+		char buffer[N];
+		return std::string(peek_some(file, buffer));
 	}
 }
\ No newline at end of file
@@ -1,34 +1,415 @@
 #include "mega.pch"
 #include "sykero_log.hpp"
 
+#include <cstdarg>
+#include <cstdio>
+#include <linux/futex.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
 #include <syslog.h>
 
 namespace sl::log
 {
-	facility::facility(int facility, const char* path)
+	namespace
+	{
+		constexpr size_t RECORD_COUNT = 256;
+		constexpr size_t MESSAGE_SIZE = 256;
+
+		static_assert(std::has_single_bit(RECORD_COUNT), "RECORD_COUNT must be a power of two");
+
+		struct record
+		{
+			std::atomic<size_t> sequence = 0;
+			int priority = 0;
+			unsigned line = 0;
+			pid_t tid = 0;
+			const char* file = nullptr;
+			char message[MESSAGE_SIZE] = {};
+		};
+
+		// A bounded multi producer queue as described by Dmitry Vyukov. The sequence number of each record tells
+		// whether it is free for the producers or ready for the consumer, so neither side ever takes a lock.
+		std::array<record, RECORD_COUNT> records;
+		alignas(64) std::atomic<size_t> enqueue_position = 0;
+		alignas(64) size_t dequeue_position = 0;
+
+		// The worker sleeps on the word with a futex, which unlike std::atomic::wait has a timeout
+		std::atomic<uint32_t> wakeups = 0;
+		static_assert(sizeof(wakeups) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free, "wakeups must be a futex word");
+
+		// The call sites which have suppressed a message, linked through rate_limit::_next
+		std::atomic<rate_limit*> suppressing = nullptr;
+		std::atomic<uint64_t> dropped_count = 0;
+		std::atomic<bool> running = false;
+		std::atomic<bool> stopping = false;
+
+#ifdef NDEBUG
+		std::atomic<int> level = LOG_INFO;
+#else
+		std::atomic<int> level = LOG_DEBUG;
+#endif
+
+		std::thread worker;
+		int journal = -1;
+		int syslog_facility = LOG_USER;
+		std::string custom_fields;
+		std::string datagram;
+
+		pid_t current_tid()
+		{
+			thread_local const pid_t tid = gettid();
+			return tid;
+		}
+
+		void append_field(std::string_view key, std::string_view value)
+		{
+			datagram.append(key);
+			datagram.push_back('=');
+			datagram.append(value);
+			datagram.push_back('\n');
+		}
+
+		template <std::integral T>
+		void append_field(std::string_view key, T value)
+		{
+			char buffer[24];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			append_field(key, std::string_view(buffer, result.ptr));
+		}
+
+		// See: https://systemd.io/JOURNAL_NATIVE_PROTOCOL/
+		bool send_to_journal(const record& r)
+		{
+			if (journal < 0)
+			{
+				return false;
+			}
+
+			datagram.clear();
+			append_field("PRIORITY", r.priority);
+			append_field("SYSLOG_FACILITY", syslog_facility >> 3);
+			append_field("SYSLOG_IDENTIFIER", "sykerolabs");
+			append_field("SYSLOG_PID", getpid());
+			append_field("TID", r.tid);
+			append_field("CODE_FILE", r.file);
+			append_field("CODE_LINE", r.line);
+			datagram.append(custom_fields);
+
+			// A newline would end the field in the simple format, multi line messages are not needed here
+			const size_t offset = datagram.size() + 8;
+			append_field("MESSAGE", r.message);
+			std::replace(datagram.begin() + offset, datagram.end() - 1, '\n', ' ');
+
+			return send(journal, datagram.data(), datagram.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(datagram.size());
+		}
+
+		void deliver(const record& r)
+		{
+			if (!send_to_journal(r))
+			{
+				::syslog(r.priority, "%s:%u: %s", r.file, r.line, r.message);
+			}
+		}
+
+		bool dequeue()
+		{
+			record& r = records[dequeue_position & (RECORD_COUNT - 1)];
+
+			if (r.sequence.load(std::memory_order_acquire) != dequeue_position + 1)
+			{
+				return false;
+			}
+
+			deliver(r);
+
+			r.sequence.store(dequeue_position + RECORD_COUNT, std::memory_order_release);
+			++dequeue_position;
+			return true;
+		}
+
+		void wake_worker()
+		{
+			wakeups.fetch_add(1, std::memory_order_release);
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeups), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+		}
+
+		void wait_for_wakeup(uint32_t observed, std::chrono::nanoseconds timeout)
+		{
+			timeout = std::max(timeout, std::chrono::nanoseconds::zero());
+			const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+			const timespec relative = { static_cast<time_t>(seconds.count()), static_cast<long>((timeout - seconds).count()) };
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeups), FUTEX_WAIT_PRIVATE, observed, &relative, nullptr, 0);
+		}
+
+		void report_dropped(uint64_t& reported)
+		{
+			const uint64_t dropped = dropped_count.load(std::memory_order_relaxed);
+
+			if (dropped == reported)
+			{
+				return;
+			}
+
+			record r;
+			r.priority = LOG_WARNING;
+			r.line = __LINE__;
+			r.tid = current_tid();
+			r.file = SL_LOG_FILE;
+			std::snprintf(r.message, MESSAGE_SIZE, "dropped %llu log records.",
+				static_cast<unsigned long long>(dropped - reported));
+
+			deliver(r);
+			reported = dropped;
+		}
+
+		void drain()
+		{
+			uint64_t reported = 0;
+			auto next_report = std::chrono::steady_clock::now() + RATE_LIMIT_INTERVAL;
+
+			while (!stopping.load(std::memory_order_acquire))
+			{
+				const uint32_t observed = wakeups.load(std::memory_order_acquire);
+
+				while (dequeue())
+				{
+				}
+
+				report_dropped(reported);
+
+				const auto now = std::chrono::steady_clock::now();
+
+				if (now >= next_report)
+				{
+					rate_limit::report_suppressed();
+					next_report = now + RATE_LIMIT_INTERVAL;
+				}
+
+				wait_for_wakeup(observed, next_report - std::chrono::steady_clock::now());
+			}
+
+			while (dequeue())
+			{
+			}
+
+			report_dropped(reported);
+			rate_limit::report_suppressed();
+		}
+
+		bool connect_journal(const char* socket_path)
+		{
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+
+			if (std::strlen(socket_path) >= sizeof(address.sun_path))
+			{
+				return false;
+			}
+
+			std::strcpy(address.sun_path, socket_path);
+
+			journal = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+			if (journal < 0)
+			{
+				return false;
+			}
+
+			if (connect(journal, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				close(journal);
+				journal = -1;
+				return false;
+			}
+
+			return true;
+		}
+	}
+
+	facility::facility(
+		int facility,
+		const char* path,
+		std::initializer_list<std::string_view> fields,
+		const char* socket_path)
 	{
 		assert(path);
+		assert(socket_path);
 
 #ifdef NDEBUG
-		setlogmask(LOG_UPTO(LOG_INFO));
 		constexpr char BUILD_TYPE[] = "release";
 #else
-		setlogmask(LOG_UPTO(LOG_DEBUG));
 		constexpr char BUILD_TYPE[] = "debug";
 #endif
+		syslog_facility = facility;
+
+		// The fallback, also used when a datagram cannot be sent
 		openlog("sykerolabs", LOG_CONS | LOG_PID | LOG_NDELAY, facility);
 
-		syslog(LOG_INFO, "build date: %s", __DATE__);
-		syslog(LOG_INFO, "build time: %s", __TIME__);
-		syslog(LOG_INFO, "build type: %s", BUILD_TYPE);
+		for (std::string_view field : fields)
+		{
+			assert(field.find('=') != std::string_view::npos);
+			custom_fields.append(field);
+			custom_fields.push_back('\n');
+		}
+
+		datagram.reserve(1024 + custom_fields.size());
+
+		for (size_t i = 0; i < RECORD_COUNT; ++i)
+		{
+			records[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		enqueue_position = 0;
+		dequeue_position = 0;
 
-		syslog(LOG_INFO, "started from %s", path);
+		const bool connected = connect_journal(socket_path);
+
+		stopping = false;
+		worker = std::thread(drain);
+		running = true;
+
+		log_info("build date: %s", __DATE__);
+		log_info("build time: %s", __TIME__);
+		log_info("build type: %s", BUILD_TYPE);
+		log_info("started from %s", path);
+
+		if (!connected)
+		{
+			log_warning("%s not available, using syslog.", socket_path);
+		}
 	}
 
 	facility::~facility()
 	{
-		syslog(LOG_INFO, "stopped!");
+		log_info("stopped!");
+
+		running = false;
+		stopping = true;
+		wake_worker();
+		worker.join();
+
+		if (journal >= 0)
+		{
+			close(journal);
+			journal = -1;
+		}
 
 		closelog();
 	}
+
+	void write(int priority, const char* file, unsigned line, const char* format, ...)
+	{
+		if (priority > level.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		va_list arguments;
+
+		// Before the facility is created or after it is destroyed there is no consumer
+		if (!running.load(std::memory_order_acquire))
+		{
+			char message[MESSAGE_SIZE];
+			va_start(arguments, format);
+			std::vsnprintf(message, MESSAGE_SIZE, format, arguments);
+			va_end(arguments);
+			::syslog(priority, "%s:%u: %s", file, line, message);
+			return;
+		}
+
+		size_t position = enqueue_position.load(std::memory_order_relaxed);
+		record* r = nullptr;
+
+		while (true)
+		{
+			r = &records[position & (RECORD_COUNT - 1)];
+			const size_t sequence = r->sequence.load(std::memory_order_acquire);
+			const auto difference = static_cast<ptrdiff_t>(sequence - position);
+
+			if (difference == 0)
+			{
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (difference < 0)
+			{
+				dropped_count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+			{
+				position = enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+
+		r->priority = priority;
+		r->line = line;
+		r->tid = current_tid();
+		r->file = file;
+
+		va_start(arguments, format);
+		std::vsnprintf(r->message, MESSAGE_SIZE, format, arguments);
+		va_end(arguments);
+
+		r->sequence.store(position + 1, std::memory_order_release);
+
+		wake_worker();
+	}
+
+	void rate_limit::enlist(int priority, const char* file, unsigned line)
+	{
+		_priority = priority;
+		_line = line;
+		_file = file;
+		_next = suppressing.load(std::memory_order_relaxed);
+
+		while (!suppressing.compare_exchange_weak(_next, this, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void rate_limit::report_suppressed()
+	{
+		for (rate_limit* limit = suppressing.load(std::memory_order_acquire); limit; limit = limit->_next)
+		{
+			const uint32_t suppressed = limit->_suppressed.exchange(0, std::memory_order_relaxed);
+
+			if (!suppressed)
+			{
+				continue;
+			}
+
+			record r;
+			r.priority = limit->_priority;
+			r.line = limit->_line;
+			r.tid = current_tid();
+			r.file = limit->_file;
+			std::snprintf(r.message, MESSAGE_SIZE, "suppressed %u similar messages.", suppressed);
+
+			deliver(r);
+		}
+	}
+
+	bool enabled(int priority)
+	{
+		return priority <= level.load(std::memory_order_relaxed);
+	}
+
+	void set_level(int priority)
+	{
+		level.store(priority, std::memory_order_relaxed);
+	}
+
+	int get_level()
+	{
+		return level.load(std::memory_order_relaxed);
+	}
+
+	uint64_t dropped()
+	{
+		return dropped_count.load(std::memory_order_relaxed);
+	}
 }
\ No newline at end of file
@@ -4,39 +4,146 @@
 
 namespace sl::log
 {
+	// Starts the background thread, which sends the log records as structured fields to the journald native socket.
+	// If the socket is not available, the records go to syslog instead.
 	class facility final
 	{
 	public:
-		facility(int facility, const char* path);
+		facility(
+			int facility,
+			const char* path,
+			std::initializer_list<std::string_view> fields = {},
+			const char* socket_path = "/run/systemd/journal/socket");
 		~facility();
 		SL_NON_COPYABLE(facility);
 	};
 
-	extern "C" void syslog(int, const char*, ...);
-
-	template <size_t N, typename... Args>
-	inline void syslog_with_source_info(
-		const std::source_location& source,
-		int priority,
-		const char(&format)[N],
-		const Args... args)
+	// The offset of the file name in a path, used to get the base name of __FILE__ at compile time
+	consteval size_t basename_offset(std::string_view path)
 	{
-		char prefixed_format[N + 7] = { '%', 's', ':', '%', 'u', ':', ' ' }; // Make clang happy
-		mem::join(format, prefixed_format);
-
-		syslog(priority,
-			prefixed_format,
-			std::filesystem::path(source.file_name()).filename().c_str(),
-			source.line(),
-			args...);
+		const size_t separator = path.find_last_of('/');
+		return separator == std::string_view::npos ? 0 : separator + 1;
 	}
+
+	// Formats the message into a lock-free ring buffer. Never blocks; if the buffer is full the record is dropped and counted.
+	void write(int priority, const char* file, unsigned line, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+	// The records with a priority above the level are discarded before formatting
+	void set_level(int priority);
+
+	int get_level();
+
+	bool enabled(int priority);
+
+	uint64_t dropped();
+
+	// Each token bucket refills one token per interval up to the burst size. The burst covers the startup, e.g. a line per scheduled task.
+	constexpr size_t RATE_LIMIT_BURST = 32;
+	constexpr std::chrono::seconds RATE_LIMIT_INTERVAL(6);
+
+	// A token bucket per call site, kept as the theoretical arrival time of the next message
+	// so that a single compare and swap is enough. Critical and higher priorities are never limited.
+	// A call site which suppresses a message enlists itself once, and the worker reports the count every interval,
+	// so that the count is not lost when the call site goes quiet.
+	class rate_limit
+	{
+	public:
+		constexpr rate_limit() = default;
+		SL_NON_COPYABLE(rate_limit);
+
+		bool allow(int priority, const char* file, unsigned line)
+		{
+			if (!enabled(priority))
+			{
+				return false;
+			}
+
+			if (priority <= 2)
+			{
+				return true;
+			}
+
+			constexpr int64_t INTERVAL = std::chrono::nanoseconds(RATE_LIMIT_INTERVAL).count();
+			constexpr int64_t TOLERANCE = INTERVAL * RATE_LIMIT_BURST;
+
+			const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+			int64_t arrival = _arrival.load(std::memory_order_relaxed);
+			int64_t next = 0;
+
+			do
+			{
+				next = std::max(arrival, now) + INTERVAL;
+
+				if (next - now > TOLERANCE)
+				{
+					_suppressed.fetch_add(1, std::memory_order_relaxed);
+
+					if (!_enlisted.exchange(true, std::memory_order_relaxed))
+					{
+						enlist(priority, file, line);
+					}
+
+					return false;
+				}
+			}
+			while (!_arrival.compare_exchange_weak(arrival, next, std::memory_order_relaxed));
+
+			const uint32_t suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+
+			if (suppressed)
+			{
+				write(priority, file, line, "suppressed %u similar messages.", suppressed);
+			}
+
+			return true;
+		}
+
+		// Reports the messages suppressed since the previous report, on the worker thread
+		static void report_suppressed();
+
+	private:
+		void enlist(int priority, const char* file, unsigned line);
+
+		std::atomic<int64_t> _arrival = 0;
+		std::atomic<uint32_t> _suppressed = 0;
+		std::atomic<bool> _enlisted = false;
+		int _priority = 0;
+		unsigned _line = 0;
+		const char* _file = nullptr;
+		rate_limit* _next = nullptr;
+	};
 }
 
-#define log_emergency(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 0, format, __VA_ARGS__)
-#define log_alert(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 1, format, __VA_ARGS__)
-#define log_critical(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 2, format, __VA_ARGS__)
-#define log_error(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 3, format, __VA_ARGS__)
-#define log_warning(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 4, format, __VA_ARGS__)
-#define log_notice(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 5, format, __VA_ARGS__)
-#define log_info(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 6, format, __VA_ARGS__)
-#define log_debug(format, ...) sl::log::syslog_with_source_info(std::source_location::current(), 7, format, __VA_ARGS__)
\ No newline at end of file
+// The call sites below this level are removed at compile time, including the evaluation of their arguments
+#ifndef SYKEROLABS_LOG_LEVEL
+#ifdef NDEBUG
+#define SYKEROLABS_LOG_LEVEL 6
+#else
+#define SYKEROLABS_LOG_LEVEL 7
+#endif
+#endif
+
+#define SL_LOG_FILE (__FILE__ + std::integral_constant<size_t, sl::log::basename_offset(__FILE__)>::value)
+
+#define SL_LOG(priority, format, ...) \
+	do \
+	{ \
+		if constexpr (priority <= SYKEROLABS_LOG_LEVEL) \
+		{ \
+			static sl::log::rate_limit sl_log_rate_limit; \
+			if (sl_log_rate_limit.allow(priority, SL_LOG_FILE, __LINE__)) \
+			{ \
+				sl::log::write(priority, SL_LOG_FILE, __LINE__, format __VA_OPT__(,) __VA_ARGS__); \
+			} \
+		} \
+	} \
+	while (false)
+
+#define log_emergency(format, ...) SL_LOG(0, format __VA_OPT__(,) __VA_ARGS__)
+#define log_alert(format, ...) SL_LOG(1, format __VA_OPT__(,) __VA_ARGS__)
+#define log_critical(format, ...) SL_LOG(2, format __VA_OPT__(,) __VA_ARGS__)
+#define log_error(format, ...) SL_LOG(3, format __VA_OPT__(,) __VA_ARGS__)
+#define log_warning(format, ...) SL_LOG(4, format __VA_OPT__(,) __VA_ARGS__)
+#define log_notice(format, ...) SL_LOG(5, format __VA_OPT__(,) __VA_ARGS__)
+#define log_info(format, ...) SL_LOG(6, format __VA_OPT__(,) __VA_ARGS__)
+#define log_debug(format, ...) SL_LOG(7, format __VA_OPT__(,) __VA_ARGS__)
\ No newline at end of file
@@ -60,4 +60,163 @@ namespace sl::mem
 			to[i + offset] = from[i];
 		}
 	}
+
+	// A fixed capacity double ended queue, which never allocates
+	template <typename T, size_t N>
+	class ring_buffer
+	{
+	public:
+		static_assert(N > 0, "N must be greater than zero");
+
+		constexpr bool empty() const
+		{
+			return _size == 0;
+		}
+
+		constexpr bool full() const
+		{
+			return _size == N;
+		}
+
+		constexpr size_t size() const
+		{
+			return _size;
+		}
+
+		constexpr T& front()
+		{
+			assert(_size);
+			return _data[_head];
+		}
+
+		constexpr T& back()
+		{
+			assert(_size);
+			return _data[(_head + _size - 1) % N];
+		}
+
+		constexpr void push_back(const T& value)
+		{
+			assert(_size < N);
+			_data[(_head + _size) % N] = value;
+			++_size;
+		}
+
+		constexpr void pop_front()
+		{
+			assert(_size);
+			_head = (_head + 1) % N;
+			--_size;
+		}
+
+		constexpr void pop_back()
+		{
+			assert(_size);
+			--_size;
+		}
+
+		constexpr void clear()
+		{
+			_head = 0;
+			_size = 0;
+		}
+
+	private:
+		std::array<T, N> _data = {};
+		size_t _head = 0;
+		size_t _size = 0;
+	};
+	// A fixed capacity string, which never allocates. Appending past the capacity throws, like std::string past its max_size.
+	template <size_t N>
+	class fixed_string
+	{
+	public:
+		constexpr void append(const char* text, size_t length)
+		{
+			if (length > N - _size)
+			{
+				throw std::length_error("mem::fixed_string");
+			}
+
+			std::copy_n(text, length, _data.data() + _size);
+			_size += length;
+		}
+
+		constexpr void append(const char* begin, const char* end)
+		{
+			append(begin, static_cast<size_t>(end - begin));
+		}
+
+		constexpr void append(std::string_view text)
+		{
+			append(text.data(), text.size());
+		}
+
+		constexpr void push_back(char c)
+		{
+			append(&c, 1);
+		}
+
+		constexpr fixed_string& operator += (std::string_view text)
+		{
+			append(text);
+			return *this;
+		}
+
+		constexpr fixed_string& operator += (char c)
+		{
+			push_back(c);
+			return *this;
+		}
+
+		constexpr void assign(std::string_view text)
+		{
+			clear();
+			append(text);
+		}
+
+		constexpr void clear()
+		{
+			_size = 0;
+		}
+
+		constexpr const char* data() const
+		{
+			return _data.data();
+		}
+
+		constexpr size_t size() const
+		{
+			return _size;
+		}
+
+		constexpr size_t length() const
+		{
+			return _size;
+		}
+
+		constexpr bool empty() const
+		{
+			return _size == 0;
+		}
+
+		static constexpr size_t capacity()
+		{
+			return N;
+		}
+
+		constexpr operator std::string_view() const
+		{
+			return { _data.data(), _size };
+		}
+
+		friend constexpr bool operator == (const fixed_string& lhs, std::string_view rhs)
+		{
+			return std::string_view(lhs) == rhs;
+		}
+
+	private:
+		std::array<char, N> _data = {};
+		size_t _size = 0;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,303 @@
+#include "mega.pch"
+#include "sykero_metrics.hpp"
+#include "sykero_io.hpp"
+#include "sykero_log.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace sl::metrics
+{
+	namespace
+	{
+		constinit std::mutex registry_mutex;
+		constinit metric* registry_head = nullptr;
+		constinit metric** registry_tail = &registry_head;
+
+		std::atomic<size_t> next_shard = 0;
+
+		constexpr char RESPONSE_HEADER[] =
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Connection: close\r\n"
+			"\r\n";
+
+		// Only for the clients, waiting for a connection is interrupted by the stop event
+		constexpr std::chrono::milliseconds POLL_TIMEOUT(100);
+
+		// The longest number a sample can have, see append_number
+		constexpr size_t NUMBER_SIZE = 32;
+
+		void append_number(std::string& output, uint64_t value)
+		{
+			char buffer[24];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			output.append(buffer, result.ptr);
+		}
+
+		void append_number(std::string& output, double value)
+		{
+			if (std::isnan(value))
+			{
+				output.append("NaN");
+				return;
+			}
+
+			if (std::isinf(value))
+			{
+				output.append(value > 0 ? "+Inf" : "-Inf");
+				return;
+			}
+
+			char buffer[NUMBER_SIZE];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			output.append(buffer, result.ptr);
+		}
+
+		template <typename T>
+		void append_sample(std::string& output, const char* name, const char* suffix, const char* labels, T value)
+		{
+			output.append(name);
+			output.append(suffix);
+
+			if (labels && *labels)
+			{
+				output.push_back('{');
+				output.append(labels);
+				output.push_back('}');
+			}
+
+			output.push_back(' ');
+			append_number(output, value);
+			output.push_back('\n');
+		}
+	}
+
+	size_t thread_shard()
+	{
+		thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % COUNTER_SHARDS;
+		return shard;
+	}
+
+	metric::metric(const char* name, const char* help, const char* type) :
+		_name(name),
+		_help(help),
+		_type(type)
+	{
+		assert(name && help && type);
+
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		*registry_tail = this;
+		registry_tail = &_next;
+	}
+
+	void write_all(std::string& output)
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex);
+
+		const char* previous = nullptr;
+
+		for (const metric* m = registry_head; m; m = m->_next)
+		{
+			if (!previous || std::strcmp(previous, m->_name) != 0)
+			{
+				output.append("# HELP ");
+				output.append(m->_name);
+				output.push_back(' ');
+				output.append(m->_help);
+				output.append("\n# TYPE ");
+				output.append(m->_name);
+				output.push_back(' ');
+				output.append(m->_type);
+				output.push_back('\n');
+			}
+
+			m->write_samples(output);
+			previous = m->_name;
+		}
+	}
+
+	void write_sample(std::string& output, const char* name, const char* labels, uint64_t value)
+	{
+		append_sample(output, name, "", labels, value);
+	}
+
+	void write_sample(std::string& output, const char* name, const char* labels, double value)
+	{
+		append_sample(output, name, "", labels, value);
+	}
+
+	gauge::gauge(const char* name, const char* help, const char* labels) :
+		metric(name, help, "gauge"),
+		_labels(labels)
+	{
+	}
+
+	void gauge::write_samples(std::string& output) const
+	{
+		write_sample(output, name(), _labels, value());
+	}
+
+	histogram::histogram(const char* name, const char* help) :
+		metric(name, help, "histogram")
+	{
+	}
+
+	void histogram::write_samples(std::string& output) const
+	{
+		uint64_t cumulative = 0;
+		uint64_t next_bound = 1;
+		char labels[0x20];
+
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			cumulative += bucket_count(i);
+
+			// The bucket boundaries do not align with powers of ten, but they do with powers of two
+			if (upper_bound(i) + 1 == next_bound * 2)
+			{
+				std::snprintf(labels, sizeof(labels), "le=\"%llu\"", static_cast<unsigned long long>(upper_bound(i)));
+				append_sample(output, name(), "_bucket", labels, cumulative);
+				next_bound *= 2;
+			}
+		}
+
+		append_sample(output, name(), "_bucket", "le=\"+Inf\"", count());
+		append_sample(output, name(), "_sum", nullptr, sum());
+		append_sample(output, name(), "_count", nullptr, count());
+	}
+
+	server::server(const std::filesystem::path& path) :
+		_path(path)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+
+		if (path.native().size() >= sizeof(address.sun_path))
+		{
+			throw std::invalid_argument("socket path too long");
+		}
+
+		std::strcpy(address.sun_path, path.c_str());
+
+		_descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (_descriptor < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "socket");
+		}
+
+		// A stale socket from a previous run would make bind fail
+		unlink(path.c_str());
+
+		if (bind(_descriptor, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			const int error = errno;
+			close(_descriptor);
+			throw std::system_error(error, std::system_category(), path.c_str());
+		}
+
+		if (listen(_descriptor, 4) < 0)
+		{
+			const int error = errno;
+			close(_descriptor);
+			throw std::system_error(error, std::system_category(), "listen");
+		}
+
+		// Every metric is registered by now, so a render at startup sizes the response. Only the numbers change length,
+		// and each line has one, so that a scrape never grows the buffer after alloc::mark_initialized.
+		_response.assign(RESPONSE_HEADER);
+		write_all(_response);
+		_response.reserve(_response.size() + static_cast<size_t>(std::ranges::count(_response, '\n')) * NUMBER_SIZE);
+
+		log_info("metrics::server %s opened.", path.c_str());
+	}
+
+	server::~server()
+	{
+		close(_descriptor);
+		unlink(_path.c_str());
+
+		log_info("metrics::server %s closed.", _path.c_str());
+	}
+
+	void server::run(const io::stop_event& stop)
+	{
+		log_debug("thread %d metrics::server started.", gettid());
+
+		pollfd poll_descriptors[2] =
+		{
+			{ _descriptor, POLLIN, 0 },
+			{ stop.descriptor(), POLLIN, 0 }
+		};
+
+		while (!stop.stop_requested())
+		{
+			const int result = poll(poll_descriptors, 2, -1);
+
+			if (result < 0 && errno != EINTR)
+			{
+				log_error("poll failed; errno %d.", errno);
+				break;
+			}
+
+			if (result <= 0 || !poll_descriptors[0].revents)
+			{
+				continue;
+			}
+
+			const int client = accept4(_descriptor, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+			if (client < 0)
+			{
+				continue;
+			}
+
+			serve(client);
+			close(client);
+		}
+
+		log_debug("thread %d metrics::server stopped.", gettid());
+	}
+
+	void server::serve(int client)
+	{
+		// The request is not interpreted, but it is read so that closing the socket does not reset the connection
+		pollfd poll_descriptor = { client, POLLIN, 0 };
+
+		if (poll(&poll_descriptor, 1, POLL_TIMEOUT.count()) > 0)
+		{
+			char request[0x200];
+
+			while (recv(client, request, sizeof(request), 0) == sizeof(request))
+			{
+			}
+		}
+
+		_response.assign(RESPONSE_HEADER);
+		write_all(_response);
+
+		size_t sent = 0;
+
+		while (sent < _response.size())
+		{
+			const ssize_t result = send(client, _response.data() + sent, _response.size() - sent, MSG_NOSIGNAL);
+
+			if (result > 0)
+			{
+				sent += static_cast<size_t>(result);
+				continue;
+			}
+
+			poll_descriptor.events = POLLOUT;
+
+			if (result < 0 && errno == EAGAIN && poll(&poll_descriptor, 1, POLL_TIMEOUT.count()) > 0)
+			{
+				continue;
+			}
+
+			log_debug("metrics::server gave up a client after %zu bytes.", sent);
+			return;
+		}
+	}
+}
\ No newline at end of file
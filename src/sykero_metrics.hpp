@@ -0,0 +1,170 @@
+#pragma once
+
+#include "sykero_stats.hpp"
+
+namespace sl::io
+{
+	class stop_event;
+}
+
+namespace sl::metrics
+{
+	// Counters are split into shards, so that threads do not contend on the same cache line
+	constexpr size_t COUNTER_SHARDS = 4;
+
+	// The shard of the calling thread
+	size_t thread_shard();
+
+	// Registers itself on construction. The metrics are meant to have static storage duration,
+	// they are never unregistered. Metrics sharing a name form a family and must be registered consecutively.
+	class metric
+	{
+	public:
+		metric(const char* name, const char* help, const char* type);
+		virtual ~metric() = default;
+		SL_NON_COPYABLE(metric);
+
+		const char* name() const
+		{
+			return _name;
+		}
+
+		// Appends the metric in the Prometheus text exposition format, without the HELP and TYPE lines
+		virtual void write_samples(std::string& output) const = 0;
+
+	private:
+		friend void write_all(std::string& output);
+
+		const char* _name;
+		const char* _help;
+		const char* _type;
+		metric* _next = nullptr;
+	};
+
+	// Appends every registered metric in the Prometheus text exposition format
+	void write_all(std::string& output);
+
+	void write_sample(std::string& output, const char* name, const char* labels, uint64_t value);
+	void write_sample(std::string& output, const char* name, const char* labels, double value);
+
+	// A monotonic counter per label value, e.g. per GPIO line. Only the label values which have been counted are exposed.
+	template <size_t N = 1>
+	class counter_array : public metric
+	{
+	public:
+		counter_array(const char* name, const char* help, const char* label = nullptr) :
+			metric(name, help, "counter"),
+			_label(label)
+		{
+			assert(N == 1 || label);
+		}
+
+		void add(uint64_t amount, size_t index = 0)
+		{
+			assert(index < N);
+			_shards[thread_shard()].values[index].fetch_add(amount, std::memory_order_relaxed);
+		}
+
+		void increment(size_t index = 0)
+		{
+			add(1, index);
+		}
+
+		uint64_t value(size_t index = 0) const
+		{
+			uint64_t sum = 0;
+
+			for (const shard& s : _shards)
+			{
+				sum += s.values[index].load(std::memory_order_relaxed);
+			}
+
+			return sum;
+		}
+
+		void write_samples(std::string& output) const override
+		{
+			if (!_label)
+			{
+				write_sample(output, name(), nullptr, value());
+				return;
+			}
+
+			char labels[0x40];
+
+			for (size_t i = 0; i < N; ++i)
+			{
+				const uint64_t sum = value(i);
+
+				if (sum)
+				{
+					std::snprintf(labels, sizeof(labels), "%s=\"%zu\"", _label, i);
+					write_sample(output, name(), labels, sum);
+				}
+			}
+		}
+
+	private:
+		struct alignas(64) shard
+		{
+			std::array<std::atomic<uint64_t>, N> values = {};
+		};
+
+		const char* _label;
+		std::array<shard, COUNTER_SHARDS> _shards = {};
+	};
+
+	using counter = counter_array<1>;
+
+	// The latest value of something, written by a single owner
+	class gauge : public metric
+	{
+	public:
+		gauge(const char* name, const char* help, const char* labels = nullptr);
+
+		void set(double value)
+		{
+			_value.store(std::bit_cast<uint64_t>(value), std::memory_order_relaxed);
+		}
+
+		double value() const
+		{
+			return std::bit_cast<double>(_value.load(std::memory_order_relaxed));
+		}
+
+		void write_samples(std::string& output) const override;
+
+	private:
+		const char* _labels;
+		std::atomic<uint64_t> _value = std::bit_cast<uint64_t>(0.0);
+	};
+
+	// A stats::histogram of microseconds. Exposes the cumulative counts at each power of two.
+	class histogram : public metric, public stats::histogram<>
+	{
+	public:
+		histogram(const char* name, const char* help);
+
+		void write_samples(std::string& output) const override;
+	};
+
+	// Serves the metrics to anyone who connects to the Unix domain socket, e.g.
+	// curl --unix-socket $XDG_RUNTIME_DIR/sykerolabs.sock http://localhost/metrics
+	// The response is formatted from relaxed atomic loads only, so the threads updating the metrics are never blocked.
+	class server final
+	{
+	public:
+		explicit server(const std::filesystem::path& path);
+		~server();
+		SL_NON_COPYABLE(server);
+
+		void run(const io::stop_event& stop);
+
+	private:
+		void serve(int client);
+
+		std::filesystem::path _path;
+		int _descriptor = -1;
+		std::string _response;
+	};
+}
\ No newline at end of file
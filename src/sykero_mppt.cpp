@@ -2,9 +2,16 @@
 #include "sykerolabs.hpp"
 #include "sykero_mppt.hpp"
 #include "sykero_log.hpp"
+#include "sykero_alloc.hpp"
 
 namespace sl::mppt
 {
+	namespace
+	{
+		metrics::counter blocks_parsed("sykerolabs_mppt_blocks_parsed_total", "VE.Direct blocks which passed the checksum");
+		metrics::counter blocks_invalid("sykerolabs_mppt_blocks_invalid_total", "VE.Direct blocks discarded for a checksum or delimiter error");
+	}
+
 	constexpr char DELIM_LF = '\n';
 	constexpr char DELIM_CR = '\r';
 	constexpr char DELIM_TAB = '\t';
@@ -12,6 +19,11 @@ namespace sl::mppt
 	constexpr char KEY_CHECKSUM[] = "Checksum";
 
 	mppt_properties::mppt_properties() :
+		battery_voltage(SMOOTHING_HORIZONS),
+		battery_current(SMOOTHING_HORIZONS),
+		panel_voltage(SMOOTHING_HORIZONS),
+		panel_power(SMOOTHING_HORIZONS),
+		load_current(SMOOTHING_HORIZONS),
 		prop_map(std::to_array<std::pair<std::string, property*>>(
 		{
 			{ "V", &battery_voltage },
@@ -27,12 +39,48 @@ namespace sl::mppt
 	{
 	}
 
+	mppt_values mppt_properties::values()
+	{
+		mppt_values result;
+		result.battery_voltage = battery_voltage.get();
+		result.battery_current = battery_current.get();
+		result.panel_voltage = panel_voltage.get();
+		result.panel_power = panel_power.get();
+		result.load_current = load_current.get();
+		result.state = state.get();
+		result.error = error.get();
+		result.yield_total = yield_total.get();
+		result.max_power_today = max_power_today.get();
+
+		for (size_t i = 0; i < SMOOTHING_HORIZONS.size(); ++i)
+		{
+			result.smoothed_battery_voltage[i] = battery_voltage.smoothed(i);
+			result.smoothed_battery_current[i] = battery_current.smoothed(i);
+			result.smoothed_panel_voltage[i] = panel_voltage.smoothed(i);
+			result.smoothed_panel_power[i] = panel_power.smoothed(i);
+			result.smoothed_load_current[i] = load_current.smoothed(i);
+		}
+
+		return result;
+	}
+
 	controller::controller(const std::filesystem::path& path) :
 		io::file_descriptor(path, O_RDONLY | O_NOCTTY | O_NDELAY)
 	{
-		_key.reserve(MAX_SERIAL_STRING_LENGTH);
-		_value.reserve(MAX_SERIAL_STRING_LENGTH);
+		configure();
+	}
+
+	void controller::reopen(const std::filesystem::path& path)
+	{
+		file_descriptor::open(path, O_RDONLY | O_NOCTTY | O_NDELAY);
+		configure();
 
+		// The block which was cut off is useless
+		reset();
+	}
+
+	void controller::configure()
+	{
 		// get existing options
 		termios options = tcgetattr();
 
@@ -64,18 +112,23 @@ namespace sl::mppt
 		tcflush(TCIFLUSH);
 	}
 
-	std::span<uint8_t> controller::read_serial(std::span<uint8_t> buffer)
+	std::span<uint8_t> controller::read_serial(std::span<uint8_t> buffer, const io::stop_event& stop)
 	{
-		if (!poll(std::chrono::milliseconds(100), POLLIN))
+		if (!poll(io::INFINITE, POLLIN, stop))
 		{
 			return std::span<uint8_t>();
 		}
 
 		size_t bytes_read = read(buffer.data(), buffer.size());
 
+		// Readable, but without data, means that the port has hung up, e.g. the USB adapter was unplugged
 		if (!bytes_read)
 		{
-			return std::span<uint8_t>();
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			// Losing the device is not the steady state
+			const alloc::exemption unplugged;
+#endif
+			throw std::system_error(EIO, std::system_category(), "read_serial");
 		}
 
 		return { buffer.data(), bytes_read };
@@ -83,6 +136,8 @@ namespace sl::mppt
 
 	bool controller::parse(std::span<const uint8_t> data)
 	{
+		SL_TRACE_SPAN("mppt::parse");
+
 		bool block_ready = false;
 
 		for (const auto& byte : data)
@@ -253,6 +308,7 @@ namespace sl::mppt
 			value->commit();
 		}
 
+		blocks_parsed.increment();
 		log_debug("parsed block #%zu", _block_counter);
 		reset();
 	}
@@ -266,6 +322,7 @@ namespace sl::mppt
 			value->undo();
 		}
 
+		blocks_invalid.increment();
 		log_debug("discarded block #%zu", _block_counter);
 		reset();
 	}
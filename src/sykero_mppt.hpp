@@ -1,18 +1,61 @@
 #pragma once
 
+#include "sykerolabs.hpp"
 #include "sykero_io.hpp"
 #include "sykero_props.hpp"
 
 namespace sl::mppt
 {
+	// The horizons of the smoothed averages, i.e. 10 seconds, 1 minute and 15 minutes
+	constexpr std::array<std::chrono::nanoseconds, 3> SMOOTHING_HORIZONS =
+	{
+		std::chrono::seconds(10),
+		std::chrono::minutes(1),
+		std::chrono::minutes(15)
+	};
+
+	// The metric labels of the horizons
+	constexpr std::array<const char*, SMOOTHING_HORIZONS.size()> SMOOTHING_HORIZON_LABELS =
+	{
+		"horizon=\"10s\"",
+		"horizon=\"1m\"",
+		"horizon=\"15m\""
+	};
+
+	using smoothed_values = std::array<float, SMOOTHING_HORIZONS.size()>;
+
+	template <arithmetic T, typename R = std::ratio<1>>
+	using smoothed = smoothed_average<SMOOTHING_HORIZONS.size(), T, R>;
+
+	// A plain copy of the MPPT values, which can be used without holding the property group lock
+	struct mppt_values
+	{
+		float battery_voltage = 0.0f;
+		float battery_current = 0.0f;
+		float panel_voltage = 0.0f;
+		float panel_power = 0.0f;
+		float load_current = 0.0f;
+		int state = 0;
+		int error = 0;
+		float yield_total = 0.0f;
+		int max_power_today = 0;
+
+		// At each of SMOOTHING_HORIZONS
+		smoothed_values smoothed_battery_voltage = {};
+		smoothed_values smoothed_battery_current = {};
+		smoothed_values smoothed_panel_voltage = {};
+		smoothed_values smoothed_panel_power = {};
+		smoothed_values smoothed_load_current = {};
+	};
+
 	// https://www.victronenergy.com/upload/documents/VE.Direct-Protocol-3.34.pdf
 	struct mppt_properties
 	{
-		snapshot_average<float, std::milli> battery_voltage;
-		snapshot_average<float, std::milli> battery_current;
-		snapshot_average<float, std::milli> panel_voltage;
-		snapshot_average<float> panel_power;
-		snapshot_average<float, std::milli> load_current;
+		smoothed<float, std::milli> battery_voltage;
+		smoothed<float, std::milli> battery_current;
+		smoothed<float, std::milli> panel_voltage;
+		smoothed<float> panel_power;
+		smoothed<float, std::milli> load_current;
 
 		snapshot<int> state;
 		snapshot<int> error;
@@ -23,6 +66,8 @@ namespace sl::mppt
 		const std::array<std::pair<std::string, property*>, 9> prop_map;
 
 		mppt_properties();
+
+		mppt_values values();
 	};
 
 	class controller : public io::file_descriptor
@@ -33,7 +78,11 @@ namespace sl::mppt
 		~controller() override = default;
 		SL_NON_COPYABLE(controller);
 
-		std::span<uint8_t> read_serial(std::span<uint8_t> buffer);
+		// E.g. after a USB serial adapter has been re-enumerated
+		void reopen(const std::filesystem::path& path);
+
+		// Blocks until data arrives or the stop is requested, returns an empty span for the latter
+		std::span<uint8_t> read_serial(std::span<uint8_t> buffer, const io::stop_event& stop);
 		bool parse(std::span<const uint8_t> data);
 
 		property_group<mppt_properties> mppt_data;
@@ -56,6 +105,8 @@ namespace sl::mppt
 			BLOCK_INVALID
 		};
 
+		void configure();
+
 		frame_event advance(uint8_t byte);
 		frame_event handle_header_byte(uint8_t byte);
 		frame_event handle_key_byte(uint8_t byte);
@@ -69,8 +120,9 @@ namespace sl::mppt
 		void reset();
 
 		frame_state _state = frame_state::HEADER;
-		std::string _key;
-		std::string _value;
+		// One more than the maximum, because the length is checked after the byte has been appended
+		mem::fixed_string<MAX_SERIAL_STRING_LENGTH + 1> _key;
+		mem::fixed_string<MAX_SERIAL_STRING_LENGTH + 1> _value;
 		uint8_t _checksum = 0;
 		size_t _block_counter = 0;
 	};
@@ -0,0 +1,141 @@
+#include "mega.pch"
+#include "sykero_power.hpp"
+#include "sykero_log.hpp"
+#include "sykero_metrics.hpp"
+
+namespace sl::power
+{
+	namespace
+	{
+		metrics::gauge current_tier("sykerolabs_power_tier", "Current power tier, 0 is the most capable");
+		metrics::counter_array<MAX_TIERS> tier_seconds("sykerolabs_power_tier_seconds_total", "Time spent in each power tier", "tier");
+		metrics::counter_array<MAX_TIERS> tier_wakeups("sykerolabs_power_tier_wakeups_total", "Scheduler wakeups in each power tier", "tier");
+
+		double per_minute(uint64_t count, std::chrono::nanoseconds time)
+		{
+			const double minutes = std::chrono::duration<double, std::ratio<60>>(time).count();
+			return minutes > 0.0 ? static_cast<double>(count) / minutes : 0.0;
+		}
+	}
+
+	policy::policy(std::span<const tier> tiers, float hysteresis_volts) :
+		_tiers(tiers),
+		_hysteresis_volts(hysteresis_volts),
+		_log_level(log::get_level())
+	{
+		if (tiers.empty() || tiers.size() > MAX_TIERS)
+		{
+			throw std::invalid_argument("there must be 1 - MAX_TIERS power tiers");
+		}
+
+		for (size_t i = 2; i < tiers.size(); ++i)
+		{
+			if (!(tiers[i].enter_volts < tiers[i - 1].enter_volts))
+			{
+				throw std::invalid_argument("the power tiers must be ordered by descending voltage");
+			}
+		}
+
+		_usage[_current].entries = 1;
+		current_tier.set(0);
+	}
+
+	bool policy::update(float battery_volts, float battery_amperes, int charger_state)
+	{
+		if (battery_volts <= 0.0f)
+		{
+			return false;
+		}
+
+		size_t next = _current;
+
+		if (charger_state == CHARGER_STATE_FLOAT)
+		{
+			next = 0;
+		}
+
+		while (next + 1 < _tiers.size() && battery_volts < _tiers[next + 1].enter_volts)
+		{
+			++next;
+		}
+
+		if (next == _current && battery_amperes >= 0.0f)
+		{
+			while (next > 0 && battery_volts >= _tiers[next].enter_volts + _hysteresis_volts)
+			{
+				--next;
+			}
+		}
+
+		if (next == _current)
+		{
+			return false;
+		}
+
+		const size_t previous = _current;
+		_current = next;
+
+		// Before logging, so that the change is not filtered out by the level it leaves
+		log::set_level(std::min(_tiers[_current].log_level, _log_level));
+
+		if (_current > previous)
+		{
+			log_warning("power tier %s -> %s, battery %.2f V %.2f A, charger state %d.",
+				_tiers[previous].name,
+				_tiers[_current].name,
+				battery_volts,
+				battery_amperes,
+				charger_state);
+		}
+		else
+		{
+			log_notice("power tier %s -> %s, battery %.2f V %.2f A, charger state %d.",
+				_tiers[previous].name,
+				_tiers[_current].name,
+				battery_volts,
+				battery_amperes,
+				charger_state);
+		}
+
+		++_usage[_current].entries;
+		current_tier.set(static_cast<double>(_current));
+
+		return true;
+	}
+
+	const tier& policy::current() const
+	{
+		return _tiers[_current];
+	}
+
+	void policy::account(std::chrono::nanoseconds elapsed, uint64_t wakeups, uint64_t context_switches)
+	{
+		usage& used = _usage[_current];
+		used.time += elapsed;
+		used.wakeups += wakeups;
+		used.context_switches += context_switches;
+
+		tier_seconds.add(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), _current);
+		tier_wakeups.add(wakeups, _current);
+	}
+
+	void policy::report() const
+	{
+		for (size_t i = 0; i < _tiers.size(); ++i)
+		{
+			const usage& used = _usage[i];
+
+			if (used.time <= std::chrono::nanoseconds(0))
+			{
+				continue;
+			}
+
+			log_info("power tier %s: %.2f h in %u periods, %.2f wakeups and %.2f context switches per minute.",
+				_tiers[i].name,
+				std::chrono::duration<double, std::ratio<3600>>(used.time).count(),
+				used.entries,
+				per_minute(used.wakeups, used.time),
+				per_minute(used.context_switches, used.time));
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+
+// Moves the process between performance tiers by the state of the battery, so that it samples, logs and wakes up less when the battery is low
+namespace sl::power
+{
+	constexpr size_t MAX_TIERS = 4;
+
+	// VE.Direct CS, the battery is full and the charger only keeps it there
+	constexpr int CHARGER_STATE_FLOAT = 5;
+
+	struct tier
+	{
+		const char* name;
+		float enter_volts; // Entered when the battery falls below this, ignored for the first tier
+		uint32_t sample_interval_scale; // Of the sensor sampling and the fan control intervals
+		std::chrono::minutes tds_read_interval;
+		int log_level; // Capped by the level when the policy was created
+		bool tachometers; // The edge detection, without which the fans are controlled in an open loop
+		size_t csv_commit_rows; // Rows written and synced at once
+	};
+
+	// The tiers are ordered from the most to the least capable, i.e. by descending voltage.
+	// A lower tier is entered as soon as the battery falls below its voltage, but left only when the battery has risen the hysteresis above it
+	// and is not discharging. Float charging returns to the first tier.
+	class policy final
+	{
+	public:
+		policy(std::span<const tier> tiers, float hysteresis_volts);
+		SL_NON_COPYABLE(policy);
+
+		// Returns true if the tier changed, after applying its log level. A zero voltage, i.e. no reading from the charger, keeps the current tier.
+		bool update(float battery_volts, float battery_amperes, int charger_state);
+
+		const tier& current() const;
+
+		// Adds the time and the wakeups since the previous call to the current tier
+		void account(std::chrono::nanoseconds elapsed, uint64_t wakeups, uint64_t context_switches);
+
+		// Logs the time spent in each tier and its wakeup rates
+		void report() const;
+
+	private:
+		struct usage
+		{
+			std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+			uint64_t wakeups = 0;
+			uint64_t context_switches = 0;
+			uint32_t entries = 0;
+		};
+
+		const std::span<const tier> _tiers;
+		const float _hysteresis_volts;
+		const int _log_level;
+		size_t _current = 0;
+		std::array<usage, MAX_TIERS> _usage = {};
+	};
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "sykero_mem.hpp"
+
 namespace sl
 {
 	class property
@@ -30,6 +32,11 @@ namespace sl
 				return &_data;
 			}
 
+			T& operator*()
+			{
+				return _data;
+			}
+
 		private:
 			std::unique_lock<std::mutex> _lock;
 			T& _data;
@@ -46,6 +53,91 @@ namespace sl
 
 	};
 
+	// A property group for trivially copyable data with a single, wait-free writer and lock-free readers.
+	// The data is kept in atomic words guarded by a sequence counter, i.e. a seqlock; readers retry while the writer is active.
+	// The group does not serialize its writers: if more than one thread updates it, the updates must be serialized by the caller, e.g. by a mutex.
+	template <typename T>
+	class seqlock_property_group
+	{
+	public:
+		static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+		static_assert(std::is_default_constructible_v<T>, "T must be default constructible");
+
+		seqlock_property_group()
+		{
+			publish();
+		}
+
+		SL_NON_COPYABLE(seqlock_property_group);
+
+		// Copies out a consistent T without blocking the writer
+		T snapshot() const
+		{
+			std::array<word, WORDS> copy;
+
+			while (true)
+			{
+				const size_t before = _sequence.load(std::memory_order_acquire);
+
+				if (before & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				for (size_t i = 0; i < WORDS; ++i)
+				{
+					copy[i] = _words[i].load(std::memory_order_relaxed);
+				}
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (_sequence.load(std::memory_order_relaxed) == before)
+				{
+					break;
+				}
+			}
+
+			T result;
+			std::memcpy(static_cast<void*>(&result), copy.data(), sizeof(T));
+			return result;
+		}
+
+		// Only one update at a time, two concurrent updates would interleave their sequence counts and tear the data for the readers.
+		// The function gets the writers private copy of the data.
+		template <typename F>
+		void update(F&& function)
+		{
+			function(_data);
+			publish();
+		}
+
+	private:
+		using word = uintptr_t;
+		static constexpr size_t WORDS = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+
+		void publish()
+		{
+			std::array<word, WORDS> copy = {};
+			std::memcpy(copy.data(), &_data, sizeof(T));
+
+			const size_t sequence = _sequence.load(std::memory_order_relaxed);
+			_sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			for (size_t i = 0; i < WORDS; ++i)
+			{
+				_words[i].store(copy[i], std::memory_order_relaxed);
+			}
+
+			_sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		T _data = {};
+		std::atomic<size_t> _sequence = 0;
+		std::array<std::atomic<word>, WORDS> _words;
+	};
+
 	template<typename T>
 	concept arithmetic = std::is_arithmetic_v<T>;
 
@@ -89,7 +181,10 @@ namespace sl
 		std::optional<T> _stage;
 	};
 
-	// A moving average property that maintains a circular buffer of the last N samples and calculates the average on demand.
+	template <arithmetic T>
+	using sum_type = std::conditional_t<std::is_floating_point_v<T>, double, std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>;
+
+	// A moving average property that maintains a circular buffer of the last N samples and a running sum of them.
 	template<size_t N, arithmetic T, typename R = std::ratio<1>>
 	class rolling_average : public property_base<T, R>
 	{
@@ -98,13 +193,18 @@ namespace sl
 
 		void update(T val) override
 		{
-			_buffer[_head] = val;
-			_head = (_head + 1) % N;
-			
 			if (_count < N)
 			{
 				_count++;
 			}
+			else
+			{
+				_sum -= _buffer[_head];
+			}
+
+			_buffer[_head] = val;
+			_head = (_head + 1) % N;
+			_sum += val;
 		}
 
 		T get() override
@@ -114,14 +214,7 @@ namespace sl
 				return static_cast<T>(0);
 			}
 
-			T sum = static_cast<T>(0);
-
-			for (size_t i = 0; i < _count; ++i)
-			{
-				sum += _buffer[i];
-			}
-
-			return sum / static_cast<T>(_count);
+			return static_cast<T>(_sum / static_cast<sum_type<T>>(_count));
 		}
 
 		void reset() override
@@ -129,6 +222,7 @@ namespace sl
 			_buffer.fill(T(0));
 			_head = 0;
 			_count = 0;
+			_sum = static_cast<sum_type<T>>(0);
 			this->_stage.reset();
 		}
 
@@ -136,43 +230,441 @@ namespace sl
 		std::array<T, N> _buffer;
 		size_t _head = 0;
 		size_t _count = 0;
+		sum_type<T> _sum = static_cast<sum_type<T>>(0);
+	};
+
+	using sample_clock = std::chrono::steady_clock;
+
+	template <arithmetic T>
+	struct timed_sample
+	{
+		sample_clock::time_point time;
+		T value;
+	};
+
+	// A fixed capacity window of timestamped samples. The window slides when a new sample is pushed:
+	// samples older than the span are evicted and so is the oldest sample if the window is full.
+	// N must be large enough to hold the samples of one span at the fastest sampling rate, otherwise the oldest samples are evicted
+	// by capacity and the window covers a shorter span than asked for.
+	template <size_t N, arithmetic T>
+	class sample_window
+	{
+	public:
+		explicit sample_window(std::chrono::nanoseconds span) :
+			_span(span)
+		{
+			assert(span.count() > 0);
+		}
+
+		template <typename F>
+		void push(T value, sample_clock::time_point time, F&& evict)
+		{
+			while (!_samples.empty() && (_samples.full() || _samples.front().time + _span <= time))
+			{
+				evict(_samples.front().value);
+				_samples.pop_front();
+			}
+
+			_samples.push_back({ time, value });
+		}
+
+		size_t size() const
+		{
+			return _samples.size();
+		}
+
+		void clear()
+		{
+			_samples.clear();
+		}
+
+	private:
+		const std::chrono::nanoseconds _span;
+		mem::ring_buffer<timed_sample<T>, N> _samples;
 	};
 
-	// A sample average property that maintains a running sum and count of samples, and calculates the average on demand. The average is reset after each get() call.
+	// A moving average property over a time span, e.g. the last 10 minutes. Both update() and get() are O(1).
+	template <size_t N, arithmetic T, typename R = std::ratio<1>>
+	class windowed_average : public property_base<T, R>
+	{
+	public:
+		explicit windowed_average(std::chrono::nanoseconds span) :
+			_window(span)
+		{
+		}
+
+		void update(T val) override
+		{
+			update(val, sample_clock::now());
+		}
+
+		void update(T val, sample_clock::time_point time)
+		{
+			_window.push(val, time, [this](T old)
+			{
+				_sum -= old;
+			});
+
+			_sum += val;
+		}
+
+		T get() override
+		{
+			if (!_window.size())
+			{
+				return static_cast<T>(0);
+			}
+
+			return static_cast<T>(_sum / static_cast<sum_type<T>>(_window.size()));
+		}
+
+		T sum() const
+		{
+			return static_cast<T>(_sum);
+		}
+
+		void reset() override
+		{
+			_window.clear();
+			_sum = static_cast<sum_type<T>>(0);
+			this->_stage.reset();
+		}
+
+	private:
+		sample_window<N, T> _window;
+		sum_type<T> _sum = static_cast<sum_type<T>>(0);
+	};
+
+	// A moving minimum or maximum property over a time span. Uses a monotonic deque, hence update() is amortized O(1) and get() is O(1).
+	template <size_t N, arithmetic T, typename C, typename R = std::ratio<1>>
+	class windowed_extreme : public property_base<T, R>
+	{
+	public:
+		explicit windowed_extreme(std::chrono::nanoseconds span) :
+			_span(span)
+		{
+			assert(span.count() > 0);
+		}
+
+		void update(T val) override
+		{
+			update(val, sample_clock::now());
+		}
+
+		void update(T val, sample_clock::time_point time)
+		{
+			++_sequence;
+
+			// The oldest candidate has fallen out of the window either by age or by capacity
+			while (!_deque.empty() && (_deque.front().time + _span <= time || _deque.front().sequence + N <= _sequence))
+			{
+				_deque.pop_front();
+			}
+
+			// Candidates that can never be the extreme again
+			while (!_deque.empty() && !C()(_deque.back().value, val))
+			{
+				_deque.pop_back();
+			}
+
+			_deque.push_back({ time, _sequence, val });
+		}
+
+		T get() override
+		{
+			if (_deque.empty())
+			{
+				return static_cast<T>(0);
+			}
+
+			return _deque.front().value;
+		}
+
+		void reset() override
+		{
+			_deque.clear();
+			_sequence = 0;
+			this->_stage.reset();
+		}
+
+	private:
+		struct candidate
+		{
+			sample_clock::time_point time;
+			size_t sequence;
+			T value;
+		};
+
+		const std::chrono::nanoseconds _span;
+		mem::ring_buffer<candidate, N> _deque;
+		size_t _sequence = 0;
+	};
+
+	template <size_t N, arithmetic T, typename R = std::ratio<1>>
+	using windowed_minimum = windowed_extreme<N, T, std::less<T>, R>;
+
+	template <size_t N, arithmetic T, typename R = std::ratio<1>>
+	using windowed_maximum = windowed_extreme<N, T, std::greater<T>, R>;
+
+	// A moving sample variance property over a time span. Welford's algorithm is applied both when a sample enters and leaves the window.
+	template <size_t N, arithmetic T, typename R = std::ratio<1>>
+	class windowed_variance : public property_base<T, R>
+	{
+	public:
+		explicit windowed_variance(std::chrono::nanoseconds span) :
+			_window(span)
+		{
+		}
+
+		void update(T val) override
+		{
+			update(val, sample_clock::now());
+		}
+
+		void update(T val, sample_clock::time_point time)
+		{
+			_window.push(val, time, [this](T old)
+			{
+				remove(static_cast<double>(old));
+			});
+
+			add(static_cast<double>(val));
+		}
+
+		T get() override
+		{
+			return static_cast<T>(variance());
+		}
+
+		double mean() const
+		{
+			return _mean;
+		}
+
+		double variance() const
+		{
+			return _count > 1 ? _m2 / static_cast<double>(_count - 1) : 0.0;
+		}
+
+		double standard_deviation() const
+		{
+			return std::sqrt(variance());
+		}
+
+		void reset() override
+		{
+			_window.clear();
+			_count = 0;
+			_mean = 0.0;
+			_m2 = 0.0;
+			this->_stage.reset();
+		}
+
+	private:
+		void add(double x)
+		{
+			++_count;
+			const double delta = x - _mean;
+			_mean += delta / static_cast<double>(_count);
+			_m2 += delta * (x - _mean);
+		}
+
+		void remove(double x)
+		{
+			if (_count <= 1)
+			{
+				_count = 0;
+				_mean = 0.0;
+				_m2 = 0.0;
+				return;
+			}
+
+			--_count;
+			const double delta = x - _mean;
+			_mean -= delta / static_cast<double>(_count);
+			_m2 = std::max(0.0, _m2 - delta * (x - _mean));
+		}
+
+		sample_window<N, T> _window;
+		size_t _count = 0;
+		double _mean = 0.0;
+		double _m2 = 0.0;
+	};
+
+	// A sample average property that maintains a running sum and count of samples, and calculates the average on demand.
+	// Every reader owns a cursor, which checkpoints the shared sum and count, so each reader gets the average since its own last read.
+	// get() without a cursor uses a built-in one, i.e. the average is "reset" after each get() call.
 	template <arithmetic T, typename R = std::ratio<1>>
 	class snapshot_average : public property_base<T, R>
 	{
 	public:
+		class cursor
+		{
+		private:
+			friend class snapshot_average;
+
+			sum_type<T> _sum = static_cast<sum_type<T>>(0);
+			size_t _count = 0;
+			size_t _epoch = 0;
+			T _last = static_cast<T>(0);
+		};
+
 		void update(T val) override
 		{
 			_sum += val;
 			_count++;
 		}
 
-		T get() override
+		// The cursor starts from the current state, i.e. a new reader does not see the samples before it registered
+		cursor open_cursor() const
 		{
-			if (_count)
+			cursor result;
+			result._sum = _sum;
+			result._count = _count;
+			result._epoch = _epoch;
+			return result;
+		}
+
+		T get(cursor& reader) const
+		{
+			// Reset since the previous read: the samples after the reset are new, and the last average stands until there are any
+			if (reader._epoch != _epoch)
 			{
-				_last = _sum / static_cast<T>(_count);
-				_sum = static_cast<T>(0);
-				_count = 0;
+				reader._sum = static_cast<sum_type<T>>(0);
+				reader._count = 0;
+				reader._epoch = _epoch;
+			}
+
+			if (_count != reader._count)
+			{
+				const auto count = static_cast<sum_type<T>>(_count - reader._count);
+				reader._last = static_cast<T>((_sum - reader._sum) / count);
+				reader._sum = _sum;
+				reader._count = _count;
 			}
-			
-			return _last;
+
+			return reader._last;
+		}
+
+		T get() override
+		{
+			return get(_cursor);
 		}
 
 		void reset() override
 		{
-			_sum = static_cast<T>(0);
+			_sum = static_cast<sum_type<T>>(0);
 			_count = 0;
-			_last = static_cast<T>(0);
+			++_epoch;
+			_cursor = open_cursor();
 			this->_stage.reset();
 		}
 
 	private:
-		T _sum = static_cast<T>(0);
+		sum_type<T> _sum = static_cast<sum_type<T>>(0);
 		size_t _count = 0;
-		T _last = static_cast<T>(0);
+		size_t _epoch = 0;
+		cursor _cursor;
+	};
+
+	// An exponentially weighted moving average property. Every sample has the same weight regardless of when it arrived.
+	template <arithmetic T, typename R = std::ratio<1>>
+	class exponential_average : public property_base<T, R>
+	{
+	public:
+		explicit exponential_average(double alpha) :
+			_alpha(alpha)
+		{
+			assert(alpha > 0.0 && alpha <= 1.0);
+		}
+
+		void update(T val) override
+		{
+			if (!_initialized)
+			{
+				_value = static_cast<double>(val);
+				_initialized = true;
+				return;
+			}
+
+			_value += _alpha * (static_cast<double>(val) - _value);
+		}
+
+		T get() override
+		{
+			return static_cast<T>(_value);
+		}
+
+		void reset() override
+		{
+			_value = 0.0;
+			_initialized = false;
+			this->_stage.reset();
+		}
+
+	private:
+		const double _alpha;
+		double _value = 0.0;
+		bool _initialized = false;
+	};
+
+	// An exponentially decaying average property with a time constant. The weight of a sample depends on the time elapsed
+	// since the previous sample, so irregularly arriving samples do not skew the average.
+	template <arithmetic T, typename R = std::ratio<1>>
+	class decaying_average : public property_base<T, R>
+	{
+	public:
+		explicit decaying_average(std::chrono::nanoseconds time_constant) :
+			_time_constant(std::chrono::duration<double>(time_constant).count())
+		{
+			assert(_time_constant > 0.0);
+		}
+
+		void update(T val) override
+		{
+			update(val, sample_clock::now());
+		}
+
+		void update(T val, sample_clock::time_point time)
+		{
+			if (!_initialized)
+			{
+				_value = static_cast<double>(val);
+				_last = time;
+				_initialized = true;
+				return;
+			}
+
+			const double elapsed = std::chrono::duration<double>(time - _last).count();
+
+			if (elapsed <= 0.0)
+			{
+				return;
+			}
+
+			const double weight = 1.0 - std::exp(-elapsed / _time_constant);
+			_value += weight * (static_cast<double>(val) - _value);
+			_last = time;
+		}
+
+		T get() override
+		{
+			return static_cast<T>(_value);
+		}
+
+		void reset() override
+		{
+			_value = 0.0;
+			_last = sample_clock::time_point();
+			_initialized = false;
+			this->_stage.reset();
+		}
+
+	private:
+		const double _time_constant;
+		double _value = 0.0;
+		sample_clock::time_point _last;
+		bool _initialized = false;
 	};
 
 	// A snapshot property that stores the most recently parsed value and only updates the current value when commit() is called. The undo() function discards the snapshot.
@@ -200,6 +692,141 @@ namespace sl
 		T _value = static_cast<T>(0);
 	};
 
+	template <arithmetic T>
+	struct rollup_summary
+	{
+		// The values of a period without samples, nan where there is one, so that e.g. the CSV shows the gap instead of a made up number
+		static constexpr T EMPTY = std::numeric_limits<T>::has_quiet_NaN ? std::numeric_limits<T>::quiet_NaN() : static_cast<T>(0);
+
+		T minimum = EMPTY;
+		T maximum = EMPTY;
+		T mean = EMPTY;
+		size_t count = 0;
+	};
+
+	// A rollup property, which keeps the minimum, maximum and mean of the samples of the current period, e.g. a minute.
+	template <arithmetic T, typename R = std::ratio<1>>
+	class rollup : public property_base<T, R>
+	{
+	public:
+		using summary = rollup_summary<T>;
+
+		void update(T val) override
+		{
+			if (!_count)
+			{
+				_minimum = val;
+				_maximum = val;
+			}
+			else
+			{
+				_minimum = std::min(_minimum, val);
+				_maximum = std::max(_maximum, val);
+			}
+
+			_sum += val;
+			_count++;
+		}
+
+		// The mean of the current period so far
+		T get() override
+		{
+			if (!_count)
+			{
+				return _last_mean;
+			}
+
+			return static_cast<T>(_sum / static_cast<sum_type<T>>(_count));
+		}
+
+		// Returns the summary of the current period and starts a new one. If there were no samples, the count is zero and the values are EMPTY.
+		summary summarize()
+		{
+			summary result;
+
+			if (_count)
+			{
+				result.minimum = _minimum;
+				result.maximum = _maximum;
+				result.mean = static_cast<T>(_sum / static_cast<sum_type<T>>(_count));
+				result.count = _count;
+
+				_last_mean = result.mean;
+				_sum = static_cast<sum_type<T>>(0);
+				_count = 0;
+			}
+
+			return result;
+		}
+
+		void reset() override
+		{
+			_minimum = static_cast<T>(0);
+			_maximum = static_cast<T>(0);
+			_sum = static_cast<sum_type<T>>(0);
+			_count = 0;
+			_last_mean = static_cast<T>(0);
+			this->_stage.reset();
+		}
+
+	private:
+		T _minimum = static_cast<T>(0);
+		T _maximum = static_cast<T>(0);
+		sum_type<T> _sum = static_cast<sum_type<T>>(0);
+		size_t _count = 0;
+		T _last_mean = static_cast<T>(0);
+	};
+
+	// A sample average property, which also keeps decaying averages of the same samples at H horizons.
+	// get() behaves like snapshot_average, smoothed() does not reset anything.
+	template <size_t H, arithmetic T, typename R = std::ratio<1>>
+	class smoothed_average : public snapshot_average<T, R>
+	{
+	public:
+		explicit smoothed_average(const std::array<std::chrono::nanoseconds, H>& horizons) :
+			_horizons(make_horizons(horizons, std::make_index_sequence<H>()))
+		{
+		}
+
+		void update(T val) override
+		{
+			snapshot_average<T, R>::update(val);
+
+			const auto now = sample_clock::now();
+
+			for (auto& horizon : _horizons)
+			{
+				horizon.update(val, now);
+			}
+		}
+
+		T smoothed(size_t index)
+		{
+			return _horizons.at(index).get();
+		}
+
+		void reset() override
+		{
+			snapshot_average<T, R>::reset();
+
+			for (auto& horizon : _horizons)
+			{
+				horizon.reset();
+			}
+		}
+
+	private:
+		template <size_t... I>
+		static std::array<decaying_average<T, R>, H> make_horizons(
+			const std::array<std::chrono::nanoseconds, H>& horizons,
+			std::index_sequence<I...>)
+		{
+			return { decaying_average<T, R>(horizons[I])... };
+		}
+
+		std::array<decaying_average<T, R>, H> _horizons;
+	};
+
 	template <typename T, typename DUR>
 	class frequency_counter
 	{
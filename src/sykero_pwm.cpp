@@ -1,10 +1,64 @@
 #include "mega.pch"
 #include "sykero_pwm.hpp"
 #include "sykero_log.hpp"
-#include "sykero_time.hpp"
 
 namespace sl::pwm
 {
+	namespace
+	{
+		constexpr std::array<std::string_view, 3> ATTRIBUTES = { "period", "duty_cycle", "enable" };
+
+		bool writable(const std::filesystem::path& line_path)
+		{
+			for (std::string_view attribute : ATTRIBUTES)
+			{
+				if (access((line_path / attribute).c_str(), W_OK) != 0)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		// The kernel creates the line directory with its attributes, after which udev changes their group
+		void wait_until_writable(const io::file_watcher& watcher, const std::filesystem::path& line_path)
+		{
+			const auto deadline = std::chrono::steady_clock::now() + EXPORT_TIMEOUT;
+			bool watching_line = false;
+
+			while (!writable(line_path))
+			{
+				if (!watching_line && std::filesystem::exists(line_path))
+				{
+					watcher.watch(line_path, IN_ATTRIB);
+					watching_line = true;
+					continue;
+				}
+
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+				if (!watcher.wait(remaining))
+				{
+					throw std::system_error(ETIMEDOUT, std::system_category(), line_path.c_str());
+				}
+			}
+		}
+
+		void write_attribute(const io::file_descriptor& attribute, int64_t value)
+		{
+			char text[24];
+			auto result = std::to_chars(text, text + sizeof(text) - 1, value);
+			*result.ptr++ = '\n';
+
+#ifdef SYKEROLABS_SIMULATION
+			// The simulated attribute is a regular file, which would be appended to, unlike a sysfs attribute
+			attribute.reposition(0);
+#endif
+			attribute.write(text, result.ptr - text);
+		}
+	}
+
 	chip::chip(
 		const std::filesystem::path& path,
 		uint8_t line_number,
@@ -14,12 +68,21 @@ namespace sl::pwm
 	{
 		if (!std::filesystem::exists(line_path))
 		{
+			// Watched before the export, so that the creation cannot be missed
+			io::file_watcher watcher;
+			watcher.watch(path, IN_CREATE);
+
 			{
 				io::file_descriptor export_file(path / "export", O_WRONLY);
 				export_file.write_text(std::to_string(line_number));
 			}
 
-			time::nanosleep(std::chrono::milliseconds(500));
+			const auto exported = std::chrono::steady_clock::now();
+
+			wait_until_writable(watcher, line_path);
+
+			const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - exported);
+			log_info("pwm::chip %s exported in %lld us.", line_path.c_str(), static_cast<long long>(waited.count()));
 		}
 
 		_period.open(line_path / "period", O_WRONLY);
@@ -47,7 +110,10 @@ namespace sl::pwm
 		}
 
 		_period_ns = (1.0f / frequency) * 1000000000.0f;
-		_period.write_text(std::to_string(_period_ns));
+		write_attribute(_period, _period_ns);
+
+		// The duty cycle is relative to the period
+		_duty_cycle_ns = -1;
 	}
 
 	void chip::set_duty_percent(float percent)
@@ -62,8 +128,14 @@ namespace sl::pwm
 			throw std::logic_error("set the frequency first");
 		}
 
-		std::string duty_cycle = std::to_string(int64_t(_period_ns * (percent / 100.0f)));
+		const int64_t duty_cycle_ns = _period_ns * (percent / 100.0f);
+
+		if (duty_cycle_ns == _duty_cycle_ns)
+		{
+			return;
+		}
 
-		_duty_cycle.write_text(duty_cycle);
+		write_attribute(_duty_cycle, duty_cycle_ns);
+		_duty_cycle_ns = duty_cycle_ns;
 	}
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 
 namespace sl::pwm
 {
+	// How long the exported line may take to appear, and for udev to let this user write to it
+	constexpr std::chrono::seconds EXPORT_TIMEOUT(2);
+
 	class chip final
 	{
 	public:
@@ -18,11 +21,13 @@ namespace sl::pwm
 
 		void set_frequency(float frequency);
 
+		// Writes only if the duty cycle in nanoseconds changes
 		void set_duty_percent(float percent);
 
 	private:
 		const std::filesystem::path line_path;
 		int64_t _period_ns = 0;
+		int64_t _duty_cycle_ns = -1;
 		io::file_descriptor _period;
 		io::file_descriptor _duty_cycle;
 	};
@@ -0,0 +1,142 @@
+#include "mega.pch"
+#include "sykero_rt.hpp"
+#include "sykero_footprint.hpp"
+#include "sykero_log.hpp"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+namespace sl::rt
+{
+	namespace
+	{
+		const char* policy_name(int policy)
+		{
+			switch (policy)
+			{
+				case SCHED_FIFO:
+					return "SCHED_FIFO";
+				case SCHED_RR:
+					return "SCHED_RR";
+				default:
+					return "SCHED_OTHER";
+			}
+		}
+
+		[[gnu::noinline]] void prefault_stack()
+		{
+			volatile char stack[STACK_PREFAULT_SIZE];
+			const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+			for (size_t i = 0; i < sizeof(stack); i += page_size)
+			{
+				stack[i] = 0;
+			}
+		}
+	}
+
+	void validate_limits(std::span<const thread_profile> profiles)
+	{
+		rlimit limit = {};
+		int highest = 0;
+		const char* highest_name = nullptr;
+
+		for (const thread_profile& profile : profiles)
+		{
+			if (profile.policy != SCHED_OTHER && profile.priority > highest)
+			{
+				highest = profile.priority;
+				highest_name = profile.name;
+			}
+		}
+
+		// Root, or CAP_SYS_NICE, is not bound by RLIMIT_RTPRIO. Whether the capability is there is seen only when the policy is set.
+		if (highest_name && geteuid() != 0 && getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(highest))
+		{
+			log_warning("RLIMIT_RTPRIO is %llu, below the priority %d of %s. Set LimitRTPRIO= in the service, "
+				"otherwise the threads above the limit fall back to SCHED_OTHER.",
+				static_cast<unsigned long long>(limit.rlim_cur),
+				highest,
+				highest_name);
+		}
+
+		const size_t resident = footprint::resident_size();
+
+		if (geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < resident)
+		{
+			log_warning("RLIMIT_MEMLOCK is %llu KiB, below the %zu KiB resident now. Set LimitMEMLOCK= in the service, "
+				"otherwise the memory is not locked.",
+				static_cast<unsigned long long>(limit.rlim_cur / 1024),
+				resident / 1024);
+		}
+
+		const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+		for (const thread_profile& profile : profiles)
+		{
+			if (profile.cpu >= processors)
+			{
+				log_warning("%s is configured for CPU %d, but there are only %ld, so it runs on any.", profile.name, profile.cpu, processors);
+			}
+		}
+	}
+
+	void enter(const thread_profile& profile)
+	{
+		pthread_setname_np(pthread_self(), profile.name);
+
+		if (profile.cpu >= 0)
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(profile.cpu, &cpus);
+
+			const int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+			if (result != 0)
+			{
+				log_warning("%s not bound to CPU %d; error %d.", profile.name, profile.cpu, result);
+			}
+		}
+
+		if (profile.policy != SCHED_OTHER)
+		{
+			sched_param parameters = {};
+			parameters.sched_priority = profile.priority;
+
+			const int result = pthread_setschedparam(pthread_self(), profile.policy, &parameters);
+
+			if (result == EPERM)
+			{
+				log_warning("%s stays in SCHED_OTHER, because %s %d is not permitted. Check RLIMIT_RTPRIO or CAP_SYS_NICE.",
+					profile.name,
+					policy_name(profile.policy),
+					profile.priority);
+			}
+			else if (result != 0)
+			{
+				log_warning("%s stays in SCHED_OTHER; error %d.", profile.name, result);
+			}
+		}
+
+		prefault_stack();
+
+		int policy = SCHED_OTHER;
+		sched_param actual = {};
+		pthread_getschedparam(pthread_self(), &policy, &actual);
+
+		log_info("thread %d %s runs in %s %d on CPU %d.", gettid(), profile.name, policy_name(policy), actual.sched_priority, sched_getcpu());
+	}
+
+	void lock_memory()
+	{
+		// Without MCL_ONFAULT every mapping would be populated at once, e.g. all eight megabytes of each thread stack
+		if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0)
+		{
+			log_warning("memory not locked; errno %d. Check RLIMIT_MEMLOCK or CAP_IPC_LOCK.", errno);
+			return;
+		}
+
+		log_info("memory locked, %zu KiB resident.", footprint::resident_size() / 1024);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+
+namespace sl::rt
+{
+	// How much of each thread stack is touched up front, so that the thread does not page fault on a deeper call later.
+	// Must stay below sl::THREAD_STACK_SIZE where the stacks are limited, which sykerolabs.hpp asserts.
+#ifdef SYKEROLABS_RPIZ2W
+	constexpr size_t STACK_PREFAULT_SIZE = 0x10000;
+#else
+	constexpr size_t STACK_PREFAULT_SIZE = 0x40000;
+#endif
+
+	struct thread_profile
+	{
+		const char* name;
+		int cpu; // -1 for any
+		int policy; // SCHED_FIFO, SCHED_RR or SCHED_OTHER
+		int priority; // 1 - 99 for the real-time policies, 0 otherwise
+	};
+
+	// Logs the resource limits which do not allow the profiles, i.e. why the threads will fall back to the default scheduling
+	void validate_limits(std::span<const thread_profile> profiles);
+
+	// Applies the profile to the calling thread and prefaults its stack. Logs why, if the profile could not be applied.
+	void enter(const thread_profile& profile);
+
+	// Locks the resident and the later faulted pages into memory
+	void lock_memory();
+}
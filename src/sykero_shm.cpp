@@ -0,0 +1,114 @@
+#include "mega.pch"
+#include "sykero_shm.hpp"
+#include "sykero_io.hpp"
+#include "sykero_log.hpp"
+#include "sykero_time.hpp"
+
+namespace sl::shm
+{
+	namespace
+	{
+		// The layout is documented in sykerolabs_shm.h, these keep it from drifting
+		static_assert(sizeof(sykerolabs_shm_header) == 64, "the header must be 64 bytes");
+		static_assert(sizeof(sykerolabs_shm_slot) == 32, "a slot must be 32 bytes");
+		static_assert(offsetof(sykerolabs_shm, slots) == sizeof(sykerolabs_shm_header), "the slots must follow the header");
+		static_assert(std::atomic_ref<uint32_t>::is_always_lock_free && std::atomic_ref<uint64_t>::is_always_lock_free, "the readers must not need a lock");
+		static_assert(std::atomic_ref<double>::is_always_lock_free, "the readers must not need a lock");
+
+		std::atomic<sykerolabs_shm*> published = nullptr;
+
+		int64_t now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time::clock::now().time_since_epoch()).count();
+		}
+	}
+
+	segment::segment(const char* name) :
+		_name(name)
+	{
+		const int descriptor = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+
+		if (descriptor < 0)
+		{
+			throw std::system_error(errno, std::system_category(), name);
+		}
+
+		const io::file_descriptor file(descriptor);
+
+		if (ftruncate(descriptor, sizeof(sykerolabs_shm)) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "ftruncate");
+		}
+
+		void* mapping = mmap(nullptr, sizeof(sykerolabs_shm), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+
+		if (mapping == MAP_FAILED)
+		{
+			throw std::system_error(errno, std::system_category(), "mmap");
+		}
+
+		_shm = static_cast<sykerolabs_shm*>(mapping);
+
+		// A reader of a previous run may still have it mapped, so the magic is written last
+		std::atomic_ref<uint32_t>(_shm->header.magic).store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::memset(_shm->slots, 0, sizeof(_shm->slots));
+
+		_shm->header.version = SYKEROLABS_SHM_VERSION;
+		_shm->header.header_size = sizeof(sykerolabs_shm_header);
+		_shm->header.slot_size = sizeof(sykerolabs_shm_slot);
+		_shm->header.slot_count = SYKEROLABS_SHM_VALUE_COUNT;
+		_shm->header.started_ns = now_ns();
+		std::atomic_ref<int32_t>(_shm->header.pid).store(getpid(), std::memory_order_relaxed);
+
+		std::atomic_ref<uint32_t>(_shm->header.magic).store(SYKEROLABS_SHM_MAGIC, std::memory_order_release);
+
+		published.store(_shm, std::memory_order_release);
+
+		log_info("shm::segment %s created, %zu bytes.", name, sizeof(sykerolabs_shm));
+	}
+
+	segment::~segment()
+	{
+		published.store(nullptr, std::memory_order_release);
+
+		std::atomic_ref<int32_t>(_shm->header.pid).store(0, std::memory_order_release);
+
+		munmap(_shm, sizeof(sykerolabs_shm));
+		shm_unlink(_name);
+
+		log_info("shm::segment %s removed.", _name);
+	}
+
+	void publish(sykerolabs_shm_value index, double value)
+	{
+		sykerolabs_shm* shm = published.load(std::memory_order_acquire);
+
+		if (!shm)
+		{
+			return;
+		}
+
+		sykerolabs_shm_slot& slot = shm->slots[index];
+		std::atomic_ref<uint32_t> sequence(slot.sequence);
+
+		// Claims the slot by making the sequence odd, waiting out another writer of the same slot
+		uint32_t before = sequence.load(std::memory_order_relaxed) & ~1u;
+
+		while (!sequence.compare_exchange_weak(before, before + 1, std::memory_order_relaxed))
+		{
+			before &= ~1u;
+		}
+
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::atomic_ref<uint64_t> updates(slot.updates);
+
+		std::atomic_ref<int64_t>(slot.timestamp_ns).store(now_ns(), std::memory_order_relaxed);
+		std::atomic_ref<double>(slot.value).store(value, std::memory_order_relaxed);
+		updates.store(updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		sequence.store(before + 2, std::memory_order_release);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+#include "sykerolabs_shm.h"
+
+// Publishes the live values into the shared memory segment described in sykerolabs_shm.h
+namespace sl::shm
+{
+	// Creates the segment and makes it the one publish() writes to. The segment is unlinked when this is destroyed.
+	class segment final
+	{
+	public:
+		explicit segment(const char* name);
+		~segment();
+		SL_NON_COPYABLE(segment);
+
+	private:
+		const char* _name;
+		sykerolabs_shm* _shm = nullptr;
+	};
+
+	// Stamps the value with the current time. Never blocks on a reader and does nothing while there is no segment.
+	// Several threads may publish the same value, e.g. a pump from the minute tick and from the float switch interlock.
+	void publish(sykerolabs_shm_value index, double value);
+}
@@ -0,0 +1,564 @@
+#include "mega.pch"
+#include "sykero_sim.hpp"
+
+#ifdef SYKEROLABS_SIMULATION
+#include "sykerolabs.hpp"
+#include "sykero_gpio.hpp"
+#include "sykero_log.hpp"
+
+#include <cstdio>
+#include <malloc.h>
+#include <numbers>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace sl::sim
+{
+	namespace
+	{
+		environment* instance = nullptr;
+
+		void write_file(const std::filesystem::path& path, std::string_view content)
+		{
+			io::file_descriptor file(path, O_WRONLY | O_CREAT | O_TRUNC);
+			file.write(content.data(), content.size());
+		}
+
+		void create_file(const std::filesystem::path& path, std::string_view content = {})
+		{
+			std::filesystem::create_directories(path.parent_path());
+			write_file(path, content);
+		}
+
+		void write_number(const std::filesystem::path& path, double value)
+		{
+			char text[0x20];
+			const int length = std::snprintf(text, sizeof(text), "%.0f\n", value);
+			write_file(path, std::string_view(text, length));
+		}
+
+		void write_decimal(const std::filesystem::path& path, double value)
+		{
+			char text[0x20];
+			const int length = std::snprintf(text, sizeof(text), "%.3f\n", value);
+			write_file(path, std::string_view(text, length));
+		}
+
+		// A cosine between -1 and 1 over the day, which is highest at the given hour
+		double daily_curve(const std::tm& tm, double peak_hour)
+		{
+			const double hours = tm.tm_hour + tm.tm_min / 60.0 + tm.tm_sec / 3600.0;
+			return std::cos(2.0 * std::numbers::pi * (hours - peak_hour) / 24.0);
+		}
+
+		double seconds(const timeval& tv)
+		{
+			return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1000000.0;
+		}
+
+		size_t open_descriptors()
+		{
+			return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+		}
+
+		time::clock::time_point local_midnight(std::tm tm)
+		{
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+			tm.tm_sec = 0;
+			tm.tm_isdst = -1;
+
+			return std::chrono::system_clock::from_time_t(mktime(&tm));
+		}
+
+		time::clock::time_point parse_start(int argc, char** argv)
+		{
+			if (argc <= 2)
+			{
+				return local_midnight(time::local_time(std::chrono::system_clock::now()));
+			}
+
+			std::tm tm = {};
+
+			if (!strptime(argv[2], "%Y-%m-%d", &tm))
+			{
+				throw std::invalid_argument("the start date must be in YYYY-MM-DD format");
+			}
+
+			return local_midnight(tm);
+		}
+
+		std::filesystem::path resources_path()
+		{
+			std::filesystem::create_directories(paths::ROOT);
+			return paths::ROOT / "resources.csv";
+		}
+
+		// Non-blocking, so that a stalled reader makes the blocks drop instead of stopping the scheduler
+		void open_terminal(io::file_descriptor& terminal, std::filesystem::path& slave_path)
+		{
+			terminal.open("/dev/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
+
+			if (grantpt(terminal.descriptor()) < 0 || unlockpt(terminal.descriptor()) < 0)
+			{
+				throw std::system_error(errno, std::system_category(), "posix_openpt");
+			}
+
+			slave_path = ptsname(terminal.descriptor());
+		}
+
+		// The same datagram as the kernel would send
+		void send_uevent(std::string_view action, std::string_view subsystem, const std::filesystem::path& device)
+		{
+			const std::string devpath = "/devices/simulation/" + device.filename().string();
+
+			std::string datagram;
+			datagram.append(action).append("@").append(devpath).push_back('\0');
+			datagram.append("ACTION=").append(action).push_back('\0');
+			datagram.append("DEVPATH=").append(devpath).push_back('\0');
+			datagram.append("SUBSYSTEM=").append(subsystem).push_back('\0');
+
+			const std::string socket_path = (paths::ROOT / "uevent.sock").string();
+
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+			io::file_descriptor sender(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+
+			if (sendto(sender.descriptor(), datagram.data(), datagram.size(), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+			{
+				log_warning("uevent %s not sent; errno %d.", datagram.c_str(), errno);
+			}
+		}
+	}
+
+	environment::environment(int argc, char** argv) :
+		_days(argc > 1 ? std::strtod(argv[1], nullptr) : 1.0),
+		_start(parse_start(argc, argv)),
+		_started(std::chrono::steady_clock::now()),
+		_bme680(paths::IIO_DEVICE.string() + "0"),
+		_ads1015(paths::IIO_DEVICE.string() + "1"),
+		_tachometers(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)),
+		_resources(resources_path(),
+		{
+			"Date",
+			"User CPU",
+			"System CPU",
+			"Max RSS KiB",
+			"Descriptors",
+			"Heap Bytes",
+			"MPPT Blocks",
+			"MPPT Blocks Dropped"
+		})
+	{
+		if (!(_days > 0.0))
+		{
+			throw std::invalid_argument("the number of simulated days must be positive");
+		}
+
+		_end = _start + std::chrono::duration_cast<time::clock::duration>(std::chrono::duration<double, std::chrono::days::period>(_days));
+
+		time::virtual_clock::set(_start);
+
+		// The output of previous simulations is kept, only the fake devices are recreated
+		std::filesystem::remove_all(paths::ROOT / "sys");
+		std::filesystem::remove_all(paths::ROOT / "dev");
+
+		create_file(paths::CPU_TEMPERATURE, "45000\n");
+
+		create_file(_bme680 / "name", "bme680\n");
+		create_file(_bme680 / "in_temp_input", "20000\n");
+		create_file(_bme680 / "in_humidityrelative_input", "50.000\n");
+		create_file(_bme680 / "in_pressure_input", "1013.000\n");
+
+		create_file(_ads1015 / "name", "ads1015\n");
+		create_file(_ads1015 / "in_voltage0_raw", "800\n");
+		create_file(_ads1015 / "in_voltage1_raw", "800\n");
+
+		// Exported already, so that pwm::chip does not wait for the export
+		create_file(paths::PWM_CHIP / "export");
+		create_file(paths::PWM_CHIP / "pwm0" / "period");
+		create_file(paths::PWM_CHIP / "pwm0" / "duty_cycle");
+		create_file(paths::PWM_CHIP / "pwm0" / "enable");
+
+		_fan_period.open(paths::PWM_CHIP / "pwm0" / "period", O_RDONLY);
+		_fan_duty_cycle.open(paths::PWM_CHIP / "pwm0" / "duty_cycle", O_RDONLY);
+
+		// The lines are simulated in gpio::line_group, the chip only has to open
+		create_file(paths::GPIO_CHIP);
+
+		_tachometer_socket = gpio::simulated_event_socket(paths::GPIO_CHIP, pins::FAN_1_TACHOMETER).string();
+
+		// The serial port of the MPPT is the other end of the pseudo terminal
+		open_terminal(_mppt, _terminal);
+		std::filesystem::create_symlink(_terminal, paths::SERIAL0);
+
+		instance = this;
+
+		log_notice("simulating %.2f days from %s in %s.", _days, time::datetime_string(_start).c_str(), paths::ROOT.c_str());
+	}
+
+	environment::~environment()
+	{
+		instance = nullptr;
+	}
+
+	bool environment::step(time::clock::time_point time_point)
+	{
+		const std::tm tm = time::local_time(time_point);
+
+		if (tm.tm_yday != _day)
+		{
+			if (_day >= 0)
+			{
+				record_day(time_point - std::chrono::days(1));
+			}
+
+			_day = tm.tm_yday;
+			_max_power_today = 0;
+		}
+
+		if (time_point >= _end)
+		{
+			return false;
+		}
+
+		if (tm.tm_hour == REPLUG_HOUR && tm.tm_min == 0 && tm.tm_sec < STEP_INTERVAL.count())
+		{
+			replug();
+		}
+
+		if (tm.tm_min == SCRAPE_MINUTE && tm.tm_sec < STEP_INTERVAL.count())
+		{
+			scrape();
+		}
+
+		if (tm.tm_hour == DRY_POOL_HOUR && tm.tm_sec < STEP_INTERVAL.count())
+		{
+			if (tm.tm_min == 0)
+			{
+				float_switch(pins::WATER_LEVEL_SENSOR_1, WATER_LEVEL_DRY);
+				++_dry_spells;
+			}
+			else if (tm.tm_min == REFILL_MINUTE)
+			{
+				float_switch(pins::WATER_LEVEL_SENSOR_1, !WATER_LEVEL_DRY);
+			}
+		}
+
+		// A linear congruential generator is noisy enough, and repeats between runs
+		_random = _random * 1664525u + 1013904223u;
+		const double noise = static_cast<double>(_random >> 8) / static_cast<double>(1u << 24) - 0.5;
+
+		const double air_temperature = 18.0 + 8.0 * daily_curve(tm, 15.0) + noise;
+		const double sun = std::max(0.0, daily_curve(tm, 13.0) - 0.3) / 0.7;
+
+		write_number(paths::CPU_TEMPERATURE, (air_temperature + 25.0 + 2.0 * noise) * 1000.0);
+		write_number(_bme680 / "in_temp_input", air_temperature * 1000.0);
+		write_decimal(_bme680 / "in_humidityrelative_input", 60.0 - 20.0 * daily_curve(tm, 15.0) + 2.0 * noise);
+		write_decimal(_bme680 / "in_pressure_input", 1013.0 + 8.0 * daily_curve(tm, 4.0) + 0.2 * noise);
+		write_number(_ads1015 / "in_voltage0_raw", 800.0 + 40.0 * noise);
+		write_number(_ads1015 / "in_voltage1_raw", 760.0 + 40.0 * noise);
+
+		send_block(sun);
+
+		return true;
+	}
+
+	// The BME680 drops off the bus and comes back as another IIO device, and the USB serial adapter of the MPPT is re-enumerated
+	void environment::replug()
+	{
+		const std::filesystem::path bme680 = paths::IIO_DEVICE.string() + (_bme680.filename() == "iio:device0" ? "2" : "0");
+
+		send_uevent("remove", "iio", _bme680);
+		std::filesystem::rename(_bme680, bme680);
+		_bme680 = bme680;
+		send_uevent("add", "iio", _bme680);
+
+		send_uevent("remove", "tty", _terminal);
+		open_terminal(_mppt, _terminal);
+		std::filesystem::remove(paths::SERIAL0);
+		std::filesystem::create_symlink(_terminal, paths::SERIAL0);
+		send_uevent("add", "tty", _terminal);
+
+		++_replugs;
+	}
+
+	// As Prometheus would, while the scheduler waits. The response is read to the end and discarded.
+	void environment::scrape()
+	{
+		constexpr char REQUEST[] = "GET /metrics HTTP/1.0\r\n\r\n";
+		constexpr char STATUS[] = "HTTP/1.0 200 OK";
+
+		const std::string socket_path = metrics_socket_path().string();
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+		io::file_descriptor client(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+
+		const timeval timeout = { 1, 0 };
+		setsockopt(client.descriptor(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		char response[0x1000];
+		size_t received = 0;
+		bool ok = false;
+
+		if (connect(client.descriptor(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+			send(client.descriptor(), REQUEST, sizeof(REQUEST) - 1, MSG_NOSIGNAL) == sizeof(REQUEST) - 1)
+		{
+			for (ssize_t result; (result = recv(client.descriptor(), response, sizeof(response), 0)) > 0; received += static_cast<size_t>(result))
+			{
+				ok = ok || (received == 0 && std::string_view(response, static_cast<size_t>(result)).starts_with(STATUS));
+			}
+		}
+
+		if (!ok)
+		{
+			++_failed_scrapes;
+			log_warning("metrics scrape failed after %zu bytes; errno %d.", received, errno);
+		}
+
+		++_scrapes;
+	}
+
+	// Timestamped like the kernel does, so the latency from the edge to the interlock is measured in real time
+	void environment::float_switch(uint32_t offset, bool level)
+	{
+		const std::string socket_path = gpio::simulated_event_socket(paths::GPIO_CHIP, pins::WATER_LEVEL_SENSOR_1).string();
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+		gpio_v2_line_event event;
+		mem::clear(event);
+		event.timestamp_ns = std::chrono::steady_clock::now().time_since_epoch().count();
+		event.id = level ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+		event.offset = offset;
+
+		io::file_descriptor sender(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+
+		if (sendto(sender.descriptor(), &event, sizeof(event), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			log_warning("float switch %u edge not sent; errno %d.", offset, errno);
+		}
+	}
+
+	void environment::spin_fans(time::clock::time_point time_point)
+	{
+		const double elapsed = _fans_spun == time::clock::time_point() ?
+			0.0 : std::chrono::duration<double>(time_point - _fans_spun).count();
+
+		_fans_spun = time_point;
+
+		char text[0x20];
+		int64_t period = 0;
+		int64_t duty_cycle = 0;
+		const std::string_view period_text = io::peek_some(_fan_period, text);
+		std::from_chars(period_text.data(), period_text.data() + period_text.size(), period);
+		const std::string_view duty_cycle_text = io::peek_some(_fan_duty_cycle, text);
+		std::from_chars(duty_cycle_text.data(), duty_cycle_text.data() + duty_cycle_text.size(), duty_cycle);
+
+		const double duty = period > 0 ? static_cast<double>(duty_cycle) / static_cast<double>(period) : 0.0;
+		_fan_duty = duty;
+		const double weight = 1.0 - std::exp(-elapsed / SIMULATED_FAN_TIME_CONSTANT);
+
+		const std::tm tm = time::local_time(time_point);
+		const bool stalled = tm.tm_hour == FAN_STALL_HOUR && tm.tm_min < FAN_STALL_MINUTES;
+
+		if (stalled && tm.tm_min == 0 && tm.tm_sec == 0)
+		{
+			++_fan_stalls;
+		}
+
+		for (uint32_t index = 0; index < _fan_rpm.size(); ++index)
+		{
+			const double target = index == 1 && stalled ? 0.0 : SIMULATED_FAN_MAX_RPM[index] * duty;
+			_fan_rpm[index] += weight * (target - _fan_rpm[index]);
+
+			// A standing fan sends no pulses
+			if (_fan_rpm[index] >= 1.0)
+			{
+				send_pulses(index, _fan_rpm[index]);
+			}
+		}
+	}
+
+	// measure_fans counts the edges from the first of ten to the last, so the first and the last one pulse apart give the same speed.
+	// The first edge is one pulse in the past, which shows in the tachometer event latency.
+	void environment::send_pulses(uint32_t index, double rpm)
+	{
+		const auto pulse = std::chrono::nanoseconds(static_cast<int64_t>(60e9 / (rpm * FAN_TACHOMETER_PULSES_PER_REVOLUTION)));
+		const auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		_tachometer_socket.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+		std::array<gpio_v2_line_event, 2> events = {};
+
+		events[0].timestamp_ns = (now - pulse).count();
+		events[0].line_seqno = static_cast<uint32_t>(_fan_pulses[index] + 1);
+		events[1].timestamp_ns = now.count();
+		events[1].line_seqno = static_cast<uint32_t>(_fan_pulses[index] + 10);
+
+		_fan_pulses[index] += 10;
+
+		for (gpio_v2_line_event& event : events)
+		{
+			event.id = GPIO_V2_LINE_EVENT_RISING_EDGE;
+			event.offset = pins::FAN_1_TACHOMETER + index;
+
+			if (sendto(_tachometers.descriptor(), &event, sizeof(event), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+			{
+				// The edge detection is off, see gpio::line_group::detect_edges
+				if (errno == EPERM)
+				{
+					return;
+				}
+
+				log_warning("fan %u pulse not sent; errno %d.", index + 1, errno);
+				return;
+			}
+		}
+	}
+
+	// The same fields as a SmartSolar MPPT sends, terminated by a checksum byte which makes the sum of the block zero
+	void environment::send_block(double sun)
+	{
+		const double hours = std::chrono::duration<double, std::ratio<3600>>(STEP_INTERVAL).count();
+		const double charge = _battery_charge / BATTERY_CAPACITY;
+		const bool floating = sun > 0.0 && charge >= BATTERY_FLOAT_CHARGE;
+
+		// A full battery takes only what the load needs
+		const double load = BASE_LOAD_POWER + FAN_POWER * _fan_duty;
+		const uint32_t panel_power = static_cast<uint32_t>(floating ? std::min(load, sun * MAX_PANEL_POWER) : sun * MAX_PANEL_POWER);
+		const double battery_power = panel_power - load;
+
+		_battery_charge = std::clamp(_battery_charge + battery_power * hours, 0.0, BATTERY_CAPACITY);
+
+		// Roughly the resting voltage of a lead acid battery, which rises while it is charged
+		const double battery_voltage = 11.6 + 1.4 * charge + (battery_power > 0.0 ? 0.6 * battery_power / MAX_PANEL_POWER : 0.0);
+
+		_energy_total += panel_power * hours;
+		_max_power_today = std::max(_max_power_today, panel_power);
+
+		char block[0x100];
+
+		int length = std::snprintf(block, sizeof(block),
+			"\r\nPID\t0xA053"
+			"\r\nV\t%u"
+			"\r\nI\t%d"
+			"\r\nVPV\t%u"
+			"\r\nPPV\t%u"
+			"\r\nCS\t%u"
+			"\r\nERR\t0"
+			"\r\nLOAD\tON"
+			"\r\nIL\t200"
+			"\r\nH19\t%u"
+			"\r\nH21\t%u"
+			"\r\nChecksum\t",
+			static_cast<uint32_t>(battery_voltage * 1000.0),
+			static_cast<int>(battery_power / battery_voltage * 1000.0),
+			static_cast<uint32_t>(sun > 0.0 ? 15000 + sun * 3000 : 900),
+			panel_power,
+			floating ? static_cast<uint32_t>(power::CHARGER_STATE_FLOAT) : sun > 0.0 ? 3u : 0u,
+			static_cast<uint32_t>(_energy_total / 10.0), // 0.01 kWh
+			_max_power_today);
+
+		uint8_t sum = 0;
+
+		for (int i = 0; i < length; ++i)
+		{
+			sum += static_cast<uint8_t>(block[i]);
+		}
+
+		block[length++] = static_cast<char>(0x100 - sum);
+
+		try
+		{
+			_mppt.write(block, length);
+			++_blocks_sent;
+		}
+		catch (const std::system_error&)
+		{
+			++_blocks_dropped;
+		}
+	}
+
+	void environment::record_day(time::clock::time_point time_point)
+	{
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+
+		const double user = seconds(usage.ru_utime) - seconds(_previous_user);
+		const double system = seconds(usage.ru_stime) - seconds(_previous_system);
+
+		_previous_user = usage.ru_utime;
+		_previous_system = usage.ru_stime;
+
+		const size_t heap = mallinfo2().uordblks;
+
+		char date[time::timestamp_formatter::DATE_LENGTH];
+
+		_resources.append_row(
+			_timestamps.date(time_point, date),
+			user,
+			system,
+			usage.ru_maxrss,
+			open_descriptors(),
+			heap,
+			_blocks_sent,
+			_blocks_dropped);
+	}
+
+	void environment::report()
+	{
+		record_day(time::clock::now());
+
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+
+		const double simulated_days = std::chrono::duration<double, std::chrono::days::period>(time::clock::now() - _start).count();
+		const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - _started).count();
+		const double cpu = seconds(usage.ru_utime) + seconds(usage.ru_stime);
+
+		char text[0x200];
+
+		std::snprintf(text, sizeof(text),
+			"simulated %.2f days in %.2f s: user %.2f s, system %.2f s, %.3f s CPU per day, max RSS %ld KiB, %zu/%zu MPPT blocks dropped, %zu replugs, %zu dry spells, %zu fan stalls, %zu/%zu scrapes failed",
+			simulated_days,
+			wall,
+			seconds(usage.ru_utime),
+			seconds(usage.ru_stime),
+			simulated_days > 0.0 ? cpu / simulated_days : 0.0,
+			usage.ru_maxrss,
+			_blocks_dropped,
+			_blocks_sent + _blocks_dropped,
+			_replugs,
+			_dry_spells,
+			_fan_stalls,
+			_failed_scrapes,
+			_scrapes);
+
+		std::printf("%s\n", text);
+		log_notice("%s.", text);
+	}
+
+	bool step(time::clock::time_point time_point)
+	{
+		assert(instance);
+		return instance->step(time_point);
+	}
+
+	void spin_fans(time::clock::time_point time_point)
+	{
+		assert(instance);
+		instance->spin_fans(time_point);
+	}
+}
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+
+#ifdef SYKEROLABS_SIMULATION
+#include "sykero_csv.hpp"
+#include "sykero_io.hpp"
+#include "sykero_time.hpp"
+
+// Runs sl::run() without any of the hardware, against a fake sysfs tree, simulated GPIO lines and a pseudo terminal posing as the MPPT.
+// The scheduler drives the virtual clock from one deadline to the next, so a simulated day passes in seconds.
+// Once a day the devices are unplugged and plugged back, with the uevents sent to the socket which stands in for netlink,
+// and the first pool runs dry for a while, with the float switch edges sent to the socket of the line group.
+// The fans follow the PWM duty cycle and send their tachometer edges the same way.
+// The metrics are scraped every simulated hour, so that an allocation tracking build covers the metrics server too.
+// The battery is charged by the sun and drained by the load and the fans, and runs low every night.
+// Usage: sykerolabs [days] [YYYY-MM-DD]
+namespace sl::sim
+{
+	// How often the simulated sensors change and the MPPT sends a block
+	constexpr std::chrono::seconds STEP_INTERVAL(10);
+
+	constexpr uint32_t MAX_PANEL_POWER = 120; // Watts
+
+	// A small battery, so that it runs low every night and the power tiers change
+	constexpr double BATTERY_CAPACITY = 60.0; // Watt hours
+	constexpr double BATTERY_START_CHARGE = 0.5; // Of the capacity
+	constexpr double BATTERY_FLOAT_CHARGE = 0.98;
+	constexpr double BASE_LOAD_POWER = 4.0; // Watts, the Raspberry Pi and the relays
+	constexpr double FAN_POWER = 5.0; // Watts, both fans at the full duty
+
+	// When the devices are unplugged and plugged back every simulated day, see environment::replug
+	constexpr int REPLUG_HOUR = 12;
+
+	// When the first pool runs dry every simulated day, and the minute of that hour when it is refilled
+	constexpr int DRY_POOL_HOUR = 14;
+	constexpr int REFILL_MINUTE = 25;
+
+	// The simulated fans stop at 0% duty, lag behind the duty cycle, and differ from each other and from sl::FAN_MAX_RPM
+	constexpr std::array<double, 2> SIMULATED_FAN_MAX_RPM = { 2700.0, 3300.0 };
+	constexpr double SIMULATED_FAN_TIME_CONSTANT = 2.0; // Seconds
+
+	// The second fan stalls every simulated day for a while
+	constexpr int FAN_STALL_HOUR = 15;
+	constexpr int FAN_STALL_MINUTES = 5;
+
+	// When the metrics are scraped every simulated hour, see environment::scrape
+	constexpr int SCRAPE_MINUTE = 30;
+
+	class environment final
+	{
+	public:
+		environment(int argc, char** argv);
+		~environment();
+
+		SL_NON_COPYABLE(environment);
+
+		// Moves the sensors along their daily curves and sends an MPPT block. Returns false when the simulated time is over.
+		bool step(time::clock::time_point time_point);
+
+		// Moves the fans towards the speed of the current duty cycle and sends a tachometer reading of each spinning fan
+		void spin_fans(time::clock::time_point time_point);
+
+		// Prints the resource usage of the whole simulation
+		void report();
+
+		size_t failed_scrapes() const
+		{
+			return _failed_scrapes;
+		}
+
+	private:
+		void replug();
+		void scrape();
+		void float_switch(uint32_t offset, bool level);
+		void send_pulses(uint32_t index, double rpm);
+		void send_block(double sun);
+		void record_day(time::clock::time_point time_point);
+
+		double _days;
+		time::clock::time_point _start;
+		time::clock::time_point _end;
+		std::chrono::steady_clock::time_point _started;
+
+		std::filesystem::path _bme680;
+		std::filesystem::path _ads1015;
+		std::filesystem::path _terminal;
+		io::file_descriptor _mppt;
+		io::file_descriptor _fan_period;
+		io::file_descriptor _fan_duty_cycle;
+		io::file_descriptor _tachometers;
+		std::string _tachometer_socket;
+
+		uint32_t _random = 1;
+		int _day = -1;
+		double _energy_total = 0.0; // Watt hours
+		double _battery_charge = BATTERY_CAPACITY * BATTERY_START_CHARGE; // Watt hours
+		double _fan_duty = 0.0;
+		uint32_t _max_power_today = 0;
+		size_t _blocks_sent = 0;
+		size_t _blocks_dropped = 0;
+		size_t _replugs = 0;
+		size_t _dry_spells = 0;
+		time::clock::time_point _fans_spun;
+		std::array<double, 2> _fan_rpm = {};
+		std::array<uint64_t, 2> _fan_pulses = {};
+		size_t _fan_stalls = 0;
+		size_t _scrapes = 0;
+		size_t _failed_scrapes = 0;
+
+		time::timestamp_formatter _timestamps;
+		csv::file<8u> _resources;
+		timeval _previous_user = {};
+		timeval _previous_system = {};
+	};
+
+	// Called by the scheduler of sl::run() with the environment created in main
+	bool step(time::clock::time_point time_point);
+	void spin_fans(time::clock::time_point time_point);
+}
+#endif
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "sykero_log.hpp"
+
+namespace sl::stats
+{
+	// A fixed bucket histogram in the spirit of HdrHistogram. Values below 2^SUB_BITS have their own buckets,
+	// larger values fall into logarithmic buckets which are split into 2^(SUB_BITS - 1) linear sub-buckets,
+	// i.e. the relative error is at most 2^(1 - SUB_BITS). Recording is lock-free and can be done from any thread.
+	template <size_t SUB_BITS = 4, size_t MAX_BITS = 32>
+	class histogram
+	{
+	public:
+		static_assert(SUB_BITS >= 2 && SUB_BITS < MAX_BITS && MAX_BITS <= 64, "invalid bucket configuration");
+
+		static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BITS;
+		static constexpr uint64_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+		static constexpr size_t BUCKETS = SUB_BUCKETS + (MAX_BITS - SUB_BITS) * HALF_SUB_BUCKETS;
+
+		histogram() = default;
+		SL_NON_COPYABLE(histogram);
+
+		void record(uint64_t value)
+		{
+			_buckets[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+			_count.fetch_add(1, std::memory_order_relaxed);
+			_sum.fetch_add(value, std::memory_order_relaxed);
+
+			uint64_t maximum = _maximum.load(std::memory_order_relaxed);
+
+			while (value > maximum && !_maximum.compare_exchange_weak(maximum, value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		// Durations are recorded in microseconds, negative durations as zero
+		template <typename Rep, typename Period>
+		void record(std::chrono::duration<Rep, Period> duration)
+		{
+			const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+			record(micros > 0 ? static_cast<uint64_t>(micros) : 0);
+		}
+
+		uint64_t count() const
+		{
+			return _count.load(std::memory_order_relaxed);
+		}
+
+		uint64_t sum() const
+		{
+			return _sum.load(std::memory_order_relaxed);
+		}
+
+		uint64_t maximum() const
+		{
+			return _maximum.load(std::memory_order_relaxed);
+		}
+
+		uint64_t bucket_count(size_t index) const
+		{
+			return _buckets[index].load(std::memory_order_relaxed);
+		}
+
+		// The highest value which falls into the bucket
+		static constexpr uint64_t upper_bound(size_t index)
+		{
+			if (index < SUB_BUCKETS)
+			{
+				return index;
+			}
+
+			const size_t shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+			const uint64_t mantissa = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+
+			return ((mantissa + 1) << shift) - 1;
+		}
+
+		// The upper bound of the bucket where the given percentile, e.g. 99.0, of the recorded values falls into
+		uint64_t percentile(double percent) const
+		{
+			const uint64_t total = count();
+
+			if (!total)
+			{
+				return 0;
+			}
+
+			const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(total * percent / 100.0)));
+			uint64_t seen = 0;
+
+			for (size_t i = 0; i < BUCKETS; ++i)
+			{
+				seen += bucket_count(i);
+
+				if (seen >= rank)
+				{
+					return std::min(upper_bound(i), maximum());
+				}
+			}
+
+			return maximum();
+		}
+
+		// Writes a one line summary to the journal
+		void log(const char* name) const
+		{
+			log_info("%s: count %llu, p50 %llu us, p90 %llu us, p99 %llu us, max %llu us.",
+				name,
+				static_cast<unsigned long long>(count()),
+				static_cast<unsigned long long>(percentile(50.0)),
+				static_cast<unsigned long long>(percentile(90.0)),
+				static_cast<unsigned long long>(percentile(99.0)),
+				static_cast<unsigned long long>(maximum()));
+		}
+
+	private:
+		static constexpr size_t index_of(uint64_t value)
+		{
+			if (value < SUB_BUCKETS)
+			{
+				return static_cast<size_t>(value);
+			}
+
+			const size_t shift = std::bit_width(value) - SUB_BITS;
+
+			if (shift > MAX_BITS - SUB_BITS)
+			{
+				return BUCKETS - 1;
+			}
+
+			const uint64_t mantissa = value >> shift;
+
+			return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + static_cast<size_t>(mantissa - HALF_SUB_BUCKETS);
+		}
+
+		std::array<std::atomic<uint64_t>, BUCKETS> _buckets = {};
+		std::atomic<uint64_t> _count = 0;
+		std::atomic<uint64_t> _sum = 0;
+		std::atomic<uint64_t> _maximum = 0;
+	};
+}
\ No newline at end of file
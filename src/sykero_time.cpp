@@ -5,6 +5,23 @@
 
 namespace sl::time
 {
+#ifdef SYKEROLABS_SIMULATION
+	namespace
+	{
+		std::atomic<virtual_clock::rep> virtual_now = 0;
+	}
+
+	virtual_clock::time_point virtual_clock::now()
+	{
+		return time_point(duration(virtual_now.load(std::memory_order_acquire)));
+	}
+
+	void virtual_clock::set(time_point time_point)
+	{
+		virtual_now.store(time_point.time_since_epoch().count(), std::memory_order_release);
+	}
+#endif
+
 	std::tm local_time(std::chrono::system_clock::time_point time_point)
 	{
 		std::time_t tt = std::chrono::system_clock::to_time_t(time_point);
@@ -46,6 +63,23 @@ namespace sl::time
 		return std::chrono::hh_mm_ss<std::chrono::nanoseconds>(nanos_to_midnight);
 	}
 
+	std::chrono::system_clock::time_point next_midnight(std::chrono::system_clock::time_point time_point)
+	{
+		std::chrono::system_clock::time_point midnight = time_point + time_to_midnight(time_point).to_duration();
+
+		// The UTC offset might change before midnight, i.e. on a daylight saving time transition day
+		const long offset_now = local_time(time_point).tm_gmtoff;
+		const long offset_at_midnight = local_time(midnight).tm_gmtoff;
+		midnight += std::chrono::seconds(offset_now - offset_at_midnight);
+
+		if (midnight <= time_point)
+		{
+			return next_midnight(time_point + std::chrono::seconds(1));
+		}
+
+		return midnight;
+	}
+
 	template <size_t FS, size_t ES>
 	std::string to_string(
 		std::chrono::system_clock::time_point time_point,
@@ -104,81 +138,432 @@ namespace sl::time
 		return to_string(time_point, "%FT%T", "2024-02-28T16:45:18");
 	}
 
-	timer::timer(
-		std::function<void()> callback,
-		const std::chrono::hh_mm_ss<std::chrono::nanoseconds>& start_time,
-		std::chrono::nanoseconds interval) :
-		_callback(callback)
+	constexpr void write_digits(char* out, long value, size_t digits)
+	{
+		for (size_t i = digits; i > 0; --i)
+		{
+			out[i - 1] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		}
+	}
+
+	long utc_offset(std::time_t utc)
+	{
+		return local_time(std::chrono::system_clock::from_time_t(utc)).tm_gmtoff;
+	}
+
+	std::string_view timestamp_formatter::date(std::chrono::system_clock::time_point time_point, std::span<char> buffer)
+	{
+		render(std::chrono::system_clock::to_time_t(time_point));
+		return copy({ _text, DATE_LENGTH }, buffer);
+	}
+
+	std::string_view timestamp_formatter::datetime(std::chrono::system_clock::time_point time_point, std::span<char> buffer)
+	{
+		render(std::chrono::system_clock::to_time_t(time_point));
+		return copy({ _text, DATETIME_LENGTH }, buffer);
+	}
+
+	std::string_view timestamp_formatter::iso8601(std::chrono::system_clock::time_point time_point, std::span<char> buffer)
+	{
+		render(std::chrono::system_clock::to_time_t(time_point));
+		return copy({ _text, ISO8601_LENGTH }, buffer);
+	}
+
+	std::string_view timestamp_formatter::epoch_millis(std::chrono::system_clock::time_point time_point, std::span<char> buffer)
+	{
+		const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time_point.time_since_epoch()).count();
+		const auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), millis);
+
+		if (ec != std::errc())
+		{
+			throw std::invalid_argument("buffer too small");
+		}
+
+		return { buffer.data(), static_cast<size_t>(end - buffer.data()) };
+	}
+
+	std::string_view timestamp_formatter::format(
+		timestamp_format format,
+		std::chrono::system_clock::time_point time_point,
+		std::span<char> buffer)
+	{
+		switch (format)
+		{
+			case timestamp_format::DATETIME:
+				return datetime(time_point, buffer);
+			case timestamp_format::ISO8601:
+				return iso8601(time_point, buffer);
+			case timestamp_format::EPOCH_MILLIS:
+				return epoch_millis(time_point, buffer);
+		}
+
+		throw std::invalid_argument("unknown timestamp format");
+	}
+
+	void timestamp_formatter::render(std::time_t utc)
 	{
-		create();
-		start(start_time, interval);
+		if (utc < _valid_from || utc >= _valid_until)
+		{
+			refresh(utc);
+		}
+
+		const long second_of_day = static_cast<long>(utc + _offset - _local_day_start);
+
+		if (second_of_day == _rendered)
+		{
+			return;
+		}
+
+		if (_rendered < 0 || second_of_day / 3600 != _rendered / 3600)
+		{
+			write_digits(_text + 11, second_of_day / 3600, 2);
+		}
+
+		if (_rendered < 0 || second_of_day / 60 != _rendered / 60)
+		{
+			write_digits(_text + 14, second_of_day / 60 % 60, 2);
+		}
+
+		write_digits(_text + 17, second_of_day % 60, 2);
+
+		_rendered = second_of_day;
 	}
 
-	timer::~timer()
+	void timestamp_formatter::refresh(std::time_t utc)
 	{
-		if (_identifier)
+		const std::tm tm = local_time(std::chrono::system_clock::from_time_t(utc));
+		const long second_of_day = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+
+		_offset = tm.tm_gmtoff;
+		_local_day_start = utc + _offset - second_of_day;
+
+		// The offset might have changed earlier today
+		_valid_from = utc - second_of_day;
+
+		if (utc_offset(_valid_from) != _offset)
+		{
+			_valid_from = utc;
+		}
+
+		// Valid until the next midnight, or the next offset change if it comes first
+		_valid_until = _local_day_start + 86400 - _offset;
+
+		if (utc_offset(_valid_until - 1) != _offset)
 		{
-			if (timer_delete(_identifier) < 0)
+			std::time_t same = utc;
+			std::time_t different = _valid_until - 1;
+
+			while (different - same > 1)
 			{
-				log_error("timer_delete(%p) failed; errno %d.", _identifier, errno);
+				const std::time_t middle = same + (different - same) / 2;
+
+				if (utc_offset(middle) == _offset)
+				{
+					same = middle;
+				}
+				else
+				{
+					different = middle;
+				}
 			}
+
+			_valid_until = different;
 		}
 
-		log_info("time::timer %p destroyed.", _identifier);
+		write_digits(_text, tm.tm_year + 1900, 4);
+		_text[4] = '-';
+		write_digits(_text + 5, tm.tm_mon + 1, 2);
+		_text[7] = '-';
+		write_digits(_text + 8, tm.tm_mday, 2);
+		_text[10] = 'T';
+		_text[13] = ':';
+		_text[16] = ':';
+
+		const long offset_minutes = std::abs(_offset) / 60;
+		_text[19] = _offset < 0 ? '-' : '+';
+		write_digits(_text + 20, offset_minutes / 60, 2);
+		_text[22] = ':';
+		write_digits(_text + 23, offset_minutes % 60, 2);
+
+		_rendered = -1;
+
+		log_debug("time::timestamp_formatter refreshed, UTC offset %ld s.", _offset);
 	}
 
-	void timer::create()
+	std::string_view timestamp_formatter::copy(std::string_view text, std::span<char> buffer)
 	{
-		assert(_identifier == nullptr);
+		if (buffer.size() < text.size())
+		{
+			throw std::invalid_argument("buffer too small");
+		}
 
-		mem::clear(_event);
+		std::copy(text.begin(), text.end(), buffer.begin());
 
-		_event.sigev_notify = SIGEV_THREAD;
-		_event.sigev_value.sival_ptr = this;
-		_event.sigev_notify_function = notify_function;
-		_event.sigev_notify_attributes = nullptr;
+		return { buffer.data(), text.size() };
+	}
 
-		if (timer_create(CLOCK_REALTIME, &_event, &_identifier) < 0)
+	namespace
+	{
+		// An IO or parse error fails only the task, e.g. when a sensor has dropped off the bus or returned garbage, not the whole scheduler
+		template <typename F>
+		void invoke(const char* name, F&& function)
 		{
-			throw std::system_error(errno, std::system_category(), "timer_create");
+			SL_TRACE_SPAN(name);
+
+			try
+			{
+				function();
+			}
+			catch (const std::exception& e)
+			{
+				log_error("%s failed: %s.", name, e.what());
+			}
 		}
+	}
+
+	scheduler::scheduler() :
+		file_descriptor(timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC))
+	{
+		_poll_descriptors.push_back({ file_descriptor::descriptor(), POLLIN, 0 });
 
-		log_info("time::timer %p created.", _identifier);
+		// Ignored by poll until run() sets the stop event
+		_poll_descriptors.push_back({ -1, POLLIN, 0 });
+
+		log_info("time::scheduler %p created.", static_cast<void*>(this));
 	}
 
-	void timer::start(const std::chrono::hh_mm_ss<std::chrono::nanoseconds>& start_time, std::chrono::nanoseconds interval)
+	scheduler::~scheduler()
 	{
-		_spec.it_interval = duration_to_timespec(interval);
-		_spec.it_value = duration_to_timespec(start_time.to_duration());
+		log_info("time::scheduler %p destroyed.", static_cast<void*>(this));
+	}
 
-		assert(_spec.it_interval.tv_nsec >= 0 && _spec.it_interval.tv_nsec <= 999999999);
-		assert(_spec.it_value.tv_nsec >= 0 && _spec.it_value.tv_nsec <= 999999999);
+	void scheduler::add(const char* name, callback function, deadline_function next_deadline)
+	{
+		assert(name && function && next_deadline);
+
+		_tasks.push_back({ name, function, next_deadline, clock::time_point() });
+		_heap.reserve(_tasks.size());
+
+		log_debug("time::scheduler task %s added.", name);
+	}
+
+	void scheduler::every(
+		const char* name,
+		std::chrono::nanoseconds interval,
+		callback function,
+		std::chrono::nanoseconds offset)
+	{
+		assert(interval.count() > 0);
+
+		add(name, function, [=](clock::time_point now)
+		{
+			const std::chrono::nanoseconds since_epoch = now.time_since_epoch() - offset;
+			const std::chrono::nanoseconds next = (since_epoch / interval + 1) * interval + offset;
+			return clock::time_point(std::chrono::duration_cast<clock::duration>(next));
+		});
+	}
+
+	void scheduler::every(
+		const char* name,
+		interval_function interval,
+		callback function,
+		std::chrono::nanoseconds offset)
+	{
+		assert(interval);
+
+		add(name, function, [=](clock::time_point now)
+		{
+			const std::chrono::nanoseconds period = interval();
+			assert(period.count() > 0);
+
+			const std::chrono::nanoseconds since_epoch = now.time_since_epoch() - offset;
+			const std::chrono::nanoseconds next = (since_epoch / period + 1) * period + offset;
+			return clock::time_point(std::chrono::duration_cast<clock::duration>(next));
+		});
+	}
+
+	void scheduler::watch(const char* name, const io::file_descriptor& source, std::function<void()> function)
+	{
+		assert(name && function);
+
+		_watchers.push_back({ name, function });
+		_poll_descriptors.push_back({ source.descriptor(), POLLIN, 0 });
+
+		log_debug("time::scheduler watcher %s added.", name);
+	}
+
+	void scheduler::run(const io::stop_event& stop)
+	{
+		_poll_descriptors[STOP_INDEX].fd = stop.descriptor();
 
-		itimerspec old_spec;
-		mem::clear(old_spec);
+		reschedule(clock::now());
 
-		if (timer_settime(_identifier, 0, &_spec, &old_spec) < 0)
+		while (!stop.stop_requested() && !_heap.empty())
 		{
-			throw std::system_error(errno, std::system_category(), "timer_settime");
+			arm(_tasks[_heap.front()].deadline);
+
+			if (!wait())
+			{
+				log_notice("clock was set, rescheduling %zu tasks.", _tasks.size());
+				reschedule(clock::now());
+				continue;
+			}
+
+			++_wakeups;
+			run_due(clock::now());
 		}
 
-		assert(old_spec.it_interval.tv_sec == 0);
-		assert(old_spec.it_interval.tv_nsec == 0);
-		assert(old_spec.it_value.tv_sec == 0);
-		assert(old_spec.it_value.tv_sec == 0);
+		_poll_descriptors[STOP_INDEX].fd = -1;
+	}
+
+	uint64_t scheduler::wakeups() const
+	{
+		return _wakeups;
+	}
+
+	bool scheduler::earlier(size_t lhs, size_t rhs) const
+	{
+		// std::push_heap and std::pop_heap make a max heap, hence the reversed comparison.
+		// The tasks which share a deadline run in the order they were added, e.g. the CSV rotation before the minute tick at midnight.
+		if (_tasks[lhs].deadline != _tasks[rhs].deadline)
+		{
+			return _tasks[lhs].deadline > _tasks[rhs].deadline;
+		}
 
-		log_debug("time::timer %p started.", _identifier);
+		return lhs > rhs;
 	}
 
-	void timer::notify_function(sigval sv)
+	void scheduler::reschedule(clock::time_point now)
 	{
-		auto self = reinterpret_cast<timer*>(sv.sival_ptr);
+		const auto compare = [this](size_t lhs, size_t rhs)
+		{
+			return earlier(lhs, rhs);
+		};
 
-		assert(self);
+		_heap.clear();
 
-		if (self->_callback)
+		for (size_t i = 0; i < _tasks.size(); ++i)
 		{
-			self->_callback();
+			_tasks[i].deadline = _tasks[i].next_deadline(now);
+			assert(_tasks[i].deadline > now);
+
+			_heap.push_back(i);
+			std::push_heap(_heap.begin(), _heap.end(), compare);
 		}
 	}
-}
\ No newline at end of file
+
+	void scheduler::run_due(clock::time_point now)
+	{
+		const auto compare = [this](size_t lhs, size_t rhs)
+		{
+			return earlier(lhs, rhs);
+		};
+
+		while (!_heap.empty() && _tasks[_heap.front()].deadline <= now)
+		{
+			std::pop_heap(_heap.begin(), _heap.end(), compare);
+
+			task& due = _tasks[_heap.back()];
+
+			invoke(due.name, [&due]
+			{
+				due.function(due.deadline);
+			});
+
+			// Calculated after the callback, so a long running task skips its missed deadlines instead of piling up
+			const auto after = std::max(now, clock::now());
+			due.deadline = due.next_deadline(after);
+			assert(due.deadline > after);
+
+			std::push_heap(_heap.begin(), _heap.end(), compare);
+		}
+	}
+
+	void scheduler::arm(clock::time_point deadline)
+	{
+		if (deadline == _armed)
+		{
+			return;
+		}
+
+#ifdef SYKEROLABS_SIMULATION
+		// The virtual clock is set to the deadline by wait()
+		_armed = deadline;
+#else
+		itimerspec spec;
+		mem::clear(spec);
+		spec.it_value = duration_to_timespec(deadline.time_since_epoch());
+
+		assert(spec.it_value.tv_nsec >= 0 && spec.it_value.tv_nsec <= 999999999);
+
+		file_descriptor::timerfd_settime(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, spec);
+		_armed = deadline;
+#endif
+	}
+
+	bool scheduler::wait()
+	{
+#ifdef SYKEROLABS_SIMULATION
+		// Nothing happens in between the deadlines, so there is no reason to wait
+		dispatch(0);
+		virtual_clock::set(_armed);
+		return true;
+#else
+		// A watcher or the stop event woke up the wait, not the timer
+		if (!dispatch(-1))
+		{
+			return true;
+		}
+
+		uint64_t expirations = 0;
+
+		try
+		{
+			file_descriptor::read_value(expirations);
+		}
+		catch (const std::system_error& e)
+		{
+			if (e.code().value() != ECANCELED)
+			{
+				throw;
+			}
+
+			// The timer needs to be armed again
+			_armed = clock::time_point();
+			return false;
+		}
+
+		return true;
+#endif
+	}
+
+	// Returns true if the timer has expired
+	bool scheduler::dispatch(int timeout)
+	{
+		SL_TRACE_SPAN("io::poll");
+
+		const int result = ::poll(_poll_descriptors.data(), _poll_descriptors.size(), timeout);
+
+		if (result < 0)
+		{
+			// E.g. SIGUSR1, the stop arrives through the stop event
+			if (errno == EINTR)
+			{
+				return false;
+			}
+
+			throw std::system_error(errno, std::system_category(), "poll");
+		}
+
+		for (size_t i = FIRST_WATCHER_INDEX; i < _poll_descriptors.size(); ++i)
+		{
+			if (_poll_descriptors[i].revents)
+			{
+				invoke(_watchers[i - FIRST_WATCHER_INDEX].name, _watchers[i - FIRST_WATCHER_INDEX].function);
+			}
+		}
+
+		return _poll_descriptors.front().revents != 0;
+	}
+}
@@ -1,17 +1,81 @@
 #pragma once
 
+#include "sykero_io.hpp"
+
 namespace sl::time
 {
-	std::tm local_time(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
+#ifdef SYKEROLABS_SIMULATION
+	// Stands in for the system clock in the simulation. It does not run by itself: the scheduler moves it from one deadline to the next.
+	struct virtual_clock
+	{
+		using rep = std::chrono::system_clock::rep;
+		using period = std::chrono::system_clock::period;
+		using duration = std::chrono::system_clock::duration;
+		using time_point = std::chrono::system_clock::time_point;
+
+		static constexpr bool is_steady = false;
+
+		static time_point now();
+		static void set(time_point time_point);
+	};
+
+	using clock = virtual_clock;
+#else
+	using clock = std::chrono::system_clock;
+#endif
+
+	std::tm local_time(std::chrono::system_clock::time_point time_point = clock::now());
+
+	bool is_night(std::chrono::system_clock::time_point time_point = clock::now());
 
-	bool is_night(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
+	std::chrono::hh_mm_ss<std::chrono::nanoseconds> time_to_midnight(std::chrono::system_clock::time_point time_point = clock::now());
 
-	std::chrono::hh_mm_ss<std::chrono::nanoseconds> time_to_midnight(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
+	// The next local midnight strictly after the time point
+	std::chrono::system_clock::time_point next_midnight(std::chrono::system_clock::time_point time_point);
 
 	std::string time_string(const std::chrono::hh_mm_ss<std::chrono::nanoseconds>& hh_mm_ss);
-	std::string time_string(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
-	std::string date_string(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
-	std::string datetime_string(std::chrono::system_clock::time_point time_point = std::chrono::system_clock::now());
+	std::string time_string(std::chrono::system_clock::time_point time_point = clock::now());
+	std::string date_string(std::chrono::system_clock::time_point time_point = clock::now());
+	std::string datetime_string(std::chrono::system_clock::time_point time_point = clock::now());
+
+	enum class timestamp_format
+	{
+		DATETIME, // 2024-02-28T16:45:18
+		ISO8601, // 2024-02-28T16:45:18+02:00
+		EPOCH_MILLIS // 1709131518000
+	};
+
+	// Formats local timestamps into caller supplied buffers without time zone lookups or allocations.
+	// The UTC offset and the date are looked up once per day, or when the offset changes, e.g. on a daylight saving time transition.
+	// The time of day is rendered by updating only the digits which have changed since the previous call.
+	class timestamp_formatter
+	{
+	public:
+		static constexpr size_t DATE_LENGTH = 10;
+		static constexpr size_t DATETIME_LENGTH = 19;
+		static constexpr size_t ISO8601_LENGTH = 25;
+		static constexpr size_t EPOCH_MILLIS_LENGTH = 20;
+		static constexpr size_t MAX_LENGTH = std::max(ISO8601_LENGTH, EPOCH_MILLIS_LENGTH);
+
+		std::string_view date(std::chrono::system_clock::time_point time_point, std::span<char> buffer);
+		std::string_view datetime(std::chrono::system_clock::time_point time_point, std::span<char> buffer);
+		std::string_view iso8601(std::chrono::system_clock::time_point time_point, std::span<char> buffer);
+		static std::string_view epoch_millis(std::chrono::system_clock::time_point time_point, std::span<char> buffer);
+
+		std::string_view format(timestamp_format format, std::chrono::system_clock::time_point time_point, std::span<char> buffer);
+
+	private:
+		void render(std::time_t utc);
+		void refresh(std::time_t utc);
+		static std::string_view copy(std::string_view text, std::span<char> buffer);
+
+		std::time_t _valid_from = 0;
+		std::time_t _valid_until = 0;
+		std::time_t _local_day_start = 0;
+		long _offset = 0;
+		long _rendered = -1;
+		char _text[ISO8601_LENGTH] = {};
+	};
 
 	template <typename Rep, typename Period>
 	constexpr timespec duration_to_timespec(std::chrono::duration<Rep, Period> duration)
@@ -55,39 +119,83 @@ namespace sl::time
 		return timespec_to_duration<std::chrono::duration<Rep, Period>>(remaining);
 	}
 
-	template<typename T>
-	bool sleep_until_next_even()
+	// Runs periodic tasks on the thread which calls run(). The deadlines are absolute CLOCK_REALTIME time points, e.g. even minutes.
+	// The timer is cancelled if the clock is set, e.g. by NTP, in which case every deadline is recalculated.
+	class scheduler final : private io::file_descriptor
 	{
-		auto now = std::chrono::system_clock::now();
-		auto next_full_minute = std::chrono::ceil<T>(now);
+	public:
+		using clock = time::clock;
 
-		std::chrono::nanoseconds sleep_time = next_full_minute - now;
-		std::chrono::nanoseconds time_left = time::nanosleep(sleep_time);
+		// The callback gets the deadline it was scheduled for
+		using callback = std::function<void(clock::time_point)>;
 
-		return time_left.count() <= 0;
-	}
+		// Returns the next deadline strictly after the given time point
+		using deadline_function = std::function<clock::time_point(clock::time_point)>;
 
-	class timer
-	{
-	public:
-		timer(
-			std::function<void()> callback,
-			const std::chrono::hh_mm_ss<std::chrono::nanoseconds>& start_time,
-			std::chrono::nanoseconds interval = std::chrono::nanoseconds(0));
+		// Returns the current interval of a task whose interval changes, e.g. with the power tier
+		using interval_function = std::function<std::chrono::nanoseconds()>;
 
-		~timer();
+		scheduler();
+		SL_NON_COPYABLE(scheduler);
+		~scheduler();
 
-	private:
-		void create();
-		void start(
-			const std::chrono::hh_mm_ss<std::chrono::nanoseconds>& start_time,
-			std::chrono::nanoseconds interval);
+		// The tasks which are due at the same deadline run in the order they were added
+		void add(const char* name, callback function, deadline_function next_deadline);
 
-		static void notify_function(sigval);
+		// Repeats on even multiples of the interval since the epoch plus the offset, e.g. every minute on the minute
+		void every(
+			const char* name,
+			std::chrono::nanoseconds interval,
+			callback function,
+			std::chrono::nanoseconds offset = std::chrono::nanoseconds(0));
 
-		std::function<void()> _callback;
-		timer_t _identifier = nullptr;
-		sigevent _event;
-		itimerspec _spec;
+		// The same, but the interval is asked for each deadline. A changed interval applies from the next deadline of the task.
+		void every(
+			const char* name,
+			interval_function interval,
+			callback function,
+			std::chrono::nanoseconds offset = std::chrono::nanoseconds(0));
+
+		// Calls the function on the scheduler thread whenever the descriptor becomes readable. The descriptor must stay open while run() runs.
+		void watch(const char* name, const io::file_descriptor& source, std::function<void()> function);
+
+		// Returns as soon as the stop is requested, without waiting for the next deadline
+		void run(const io::stop_event& stop);
+
+		// How many times run() has woken up, for the timer or for a watched descriptor. Tasks which are due at once share a wakeup.
+		uint64_t wakeups() const;
+
+	private:
+		struct task
+		{
+			const char* name;
+			callback function;
+			deadline_function next_deadline;
+			clock::time_point deadline;
+		};
+
+		struct watcher
+		{
+			const char* name;
+			std::function<void()> function;
+		};
+
+		bool earlier(size_t lhs, size_t rhs) const;
+		void reschedule(clock::time_point now);
+		void run_due(clock::time_point now);
+		void arm(clock::time_point deadline);
+		bool wait();
+		bool dispatch(int timeout);
+
+		std::vector<task> _tasks;
+		std::vector<watcher> _watchers;
+
+		// The timer first, then the stop event, then the watched descriptors in the order of _watchers
+		static constexpr size_t STOP_INDEX = 1;
+		static constexpr size_t FIRST_WATCHER_INDEX = 2;
+		std::vector<pollfd> _poll_descriptors;
+		std::vector<size_t> _heap;
+		clock::time_point _armed;
+		uint64_t _wakeups = 0;
 	};
 }
\ No newline at end of file
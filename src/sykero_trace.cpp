@@ -0,0 +1,146 @@
+#include "mega.pch"
+#include "sykero_trace.hpp"
+#include "sykero_io.hpp"
+#include "sykero_log.hpp"
+
+namespace sl::trace
+{
+	namespace
+	{
+		// The fields are relaxed atomics only because the dump may read a slot while its owner overwrites it
+		struct event
+		{
+			std::atomic<const char*> name = nullptr;
+			std::atomic<uint64_t> begin = 0;
+			std::atomic<uint64_t> end = 0;
+		};
+
+		struct thread_buffer
+		{
+			pid_t tid = 0;
+			std::atomic<size_t> head = 0;
+			std::array<event, EVENTS_PER_THREAD> events;
+		};
+
+		// The buffers outlive their threads, so that the spans of a finished thread can still be dumped
+		std::mutex buffers_mutex;
+		std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+		std::atomic<bool> dump_flag = false;
+
+		thread_buffer& local_buffer()
+		{
+			thread_local thread_buffer* buffer = []
+			{
+				auto created = std::make_unique<thread_buffer>();
+				created->tid = gettid();
+
+				std::lock_guard<std::mutex> lock(buffers_mutex);
+				buffers.emplace_back(std::move(created));
+				return buffers.back().get();
+			}();
+
+			return *buffer;
+		}
+	}
+
+	uint64_t ticks_per_second()
+	{
+#if defined(__aarch64__)
+		uint64_t frequency;
+		asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+		return frequency;
+#else
+		return 1000000000u;
+#endif
+	}
+
+	void record(const char* name, uint64_t begin, uint64_t end)
+	{
+		thread_buffer& buffer = local_buffer();
+		const size_t head = buffer.head.load(std::memory_order_relaxed);
+		event& e = buffer.events[head & (EVENTS_PER_THREAD - 1)];
+
+		e.name.store(name, std::memory_order_relaxed);
+		e.begin.store(begin, std::memory_order_relaxed);
+		e.end.store(end, std::memory_order_relaxed);
+
+		buffer.head.store(head + 1, std::memory_order_release);
+	}
+
+	void request_dump()
+	{
+		dump_flag.store(true, std::memory_order_relaxed);
+	}
+
+	bool dump_requested()
+	{
+		return dump_flag.exchange(false, std::memory_order_relaxed);
+	}
+
+	size_t dump(const std::filesystem::path& path)
+	{
+		const double micros_per_tick = 1000000.0 / static_cast<double>(ticks_per_second());
+		const pid_t pid = getpid();
+
+		std::string json = "{\"traceEvents\":[";
+		size_t count = 0;
+		char line[0x100];
+
+		{
+			std::lock_guard<std::mutex> lock(buffers_mutex);
+
+			for (const auto& buffer : buffers)
+			{
+				const size_t head = buffer->head.load(std::memory_order_acquire);
+				const size_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+				std::vector<std::tuple<const char*, uint64_t, uint64_t>> copied;
+				copied.reserve(head - first);
+
+				for (size_t i = first; i < head; ++i)
+				{
+					const event& e = buffer->events[i & (EVENTS_PER_THREAD - 1)];
+
+					copied.emplace_back(
+						e.name.load(std::memory_order_relaxed),
+						e.begin.load(std::memory_order_relaxed),
+						e.end.load(std::memory_order_relaxed));
+				}
+
+				// The oldest slots may have been overwritten by the owner thread while they were copied. The fence keeps the copies
+				// before the reload, and the owner writes the slot of the span latest before it publishes latest + 1.
+				std::atomic_thread_fence(std::memory_order_acquire);
+				const size_t latest = buffer->head.load(std::memory_order_relaxed);
+				const size_t overwritten = latest + 1 - first > EVENTS_PER_THREAD ? latest + 1 - first - EVENTS_PER_THREAD : 0;
+
+				for (size_t i = std::min(overwritten, copied.size()); i < copied.size(); ++i)
+				{
+					const auto& [name, begin, end] = copied[i];
+
+					const int length = std::snprintf(line, sizeof(line),
+						"%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+						count ? "," : "",
+						name,
+						static_cast<double>(begin) * micros_per_tick,
+						static_cast<double>(end - begin) * micros_per_tick,
+						pid,
+						buffer->tid);
+
+					json.append(line, std::min<size_t>(length, sizeof(line) - 1));
+
+					++count;
+				}
+			}
+		}
+
+		json += "\n]}\n";
+
+		// Outside of the lock, because the IO calls record spans of their own
+		io::file_descriptor file(path, O_WRONLY | O_CREAT | O_TRUNC);
+		file.write_text(json);
+
+		log_info("%zu trace spans written to %s.", count, path.c_str());
+
+		return count;
+	}
+}
\ No newline at end of file
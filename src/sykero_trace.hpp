@@ -0,0 +1,69 @@
+#pragma once
+
+#include "sykero_mem.hpp"
+
+namespace sl::trace
+{
+	// The number of the latest spans kept per thread
+	constexpr size_t EVENTS_PER_THREAD = 4096;
+
+	static_assert(std::has_single_bit(EVENTS_PER_THREAD), "EVENTS_PER_THREAD must be a power of two");
+
+	// The ARM generic timer is readable from user space and does not go through the vDSO
+	inline uint64_t ticks()
+	{
+#if defined(__aarch64__)
+		uint64_t value;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+		return value;
+#else
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		return static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec);
+#endif
+	}
+
+	uint64_t ticks_per_second();
+
+	// Stores a finished span into the ring buffer of the calling thread, overwriting the oldest one
+	void record(const char* name, uint64_t begin, uint64_t end);
+
+	// Async-signal-safe, the dump is written later by whoever polls dump_requested
+	void request_dump();
+	bool dump_requested();
+
+	// Writes the spans of every thread as Chrome trace event JSON, which can be opened in chrome://tracing or Perfetto.
+	// Returns the number of spans written.
+	size_t dump(const std::filesystem::path& path);
+
+	class span final
+	{
+	public:
+		explicit span(const char* name) :
+			_name(name),
+			_begin(ticks())
+		{
+		}
+
+		~span()
+		{
+			record(_name, _begin, ticks());
+		}
+
+		SL_NON_COPYABLE(span);
+
+	private:
+		const char* _name;
+		uint64_t _begin;
+	};
+}
+
+#define SL_TRACE_CONCAT_IMPL(a, b) a##b
+#define SL_TRACE_CONCAT(a, b) SL_TRACE_CONCAT_IMPL(a, b)
+
+// The name must have static storage duration, e.g. a string literal
+#ifdef SYKEROLABS_TRACE
+#define SL_TRACE_SPAN(name) const sl::trace::span SL_TRACE_CONCAT(sl_trace_span_, __COUNTER__)(name)
+#else
+#define SL_TRACE_SPAN(name) static_cast<void>(0)
+#endif
\ No newline at end of file
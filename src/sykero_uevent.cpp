@@ -0,0 +1,162 @@
+#include "mega.pch"
+#include "sykero_uevent.hpp"
+#include "sykero_log.hpp"
+
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace sl::uevent
+{
+	namespace
+	{
+		// The multicast group of the kernel, as opposed to the events which udev forwards after processing them
+		constexpr uint32_t KERNEL_GROUP = 1;
+
+		int open_socket(int domain, int protocol)
+		{
+			const int descriptor = socket(domain, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, protocol);
+
+			if (descriptor < 0)
+			{
+				throw std::system_error(errno, std::system_category(), "socket");
+			}
+
+			return descriptor;
+		}
+
+		bool parse(std::string_view datagram, event& e)
+		{
+			const size_t header_end = datagram.find('\0');
+
+			// E.g. the "libudev" header of the events forwarded by udev
+			if (header_end == std::string_view::npos || datagram.substr(0, header_end).find('@') == std::string_view::npos)
+			{
+				return false;
+			}
+
+			e = {};
+
+			for (size_t begin = header_end + 1; begin < datagram.size();)
+			{
+				size_t end = datagram.find('\0', begin);
+
+				if (end == std::string_view::npos)
+				{
+					end = datagram.size();
+				}
+
+				const std::string_view pair = datagram.substr(begin, end - begin);
+				const size_t separator = pair.find('=');
+
+				if (separator != std::string_view::npos)
+				{
+					const std::string_view key = pair.substr(0, separator);
+					const std::string_view value = pair.substr(separator + 1);
+
+					if (key == "ACTION")
+					{
+						e.action = value;
+					}
+					else if (key == "SUBSYSTEM")
+					{
+						e.subsystem = value;
+					}
+					else if (key == "DEVPATH")
+					{
+						e.devpath = value;
+					}
+					else if (key == "DEVNAME")
+					{
+						e.devname = value;
+					}
+				}
+
+				begin = end + 1;
+			}
+
+			return !e.action.empty();
+		}
+	}
+
+	monitor::monitor() :
+		file_descriptor(open_socket(AF_NETLINK, NETLINK_KOBJECT_UEVENT))
+	{
+		sockaddr_nl address = {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = KERNEL_GROUP;
+
+		if (bind(descriptor(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), "bind");
+		}
+
+		log_info("uevent::monitor %p opened.", static_cast<void*>(this));
+	}
+
+	monitor::monitor(const std::filesystem::path& path) :
+		file_descriptor(open_socket(AF_UNIX, 0)),
+		_path(path)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+
+		if (path.native().size() >= sizeof(address.sun_path))
+		{
+			throw std::invalid_argument("socket path too long");
+		}
+
+		std::strcpy(address.sun_path, path.c_str());
+
+		// A stale socket from a previous run would make bind fail
+		unlink(path.c_str());
+
+		if (bind(descriptor(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			throw std::system_error(errno, std::system_category(), path.c_str());
+		}
+
+		log_info("uevent::monitor %p opened. Path: %s", static_cast<void*>(this), path.c_str());
+	}
+
+	monitor::~monitor()
+	{
+		if (!_path.empty())
+		{
+			unlink(_path.c_str());
+		}
+
+		log_info("uevent::monitor %p closed.", static_cast<void*>(this));
+	}
+
+	bool monitor::receive(event& e)
+	{
+		while (true)
+		{
+			SL_TRACE_SPAN("io::recv");
+
+			const ssize_t result = recv(descriptor(), _buffer.data(), _buffer.size(), 0);
+
+			if (result < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					return false;
+				}
+
+				if (errno == ENOBUFS)
+				{
+					e = { ACTION_LOST, {}, {}, {} };
+					return true;
+				}
+
+				throw std::system_error(errno, std::system_category(), "recv");
+			}
+
+			if (parse(std::string_view(_buffer.data(), static_cast<size_t>(result)), e))
+			{
+				return true;
+			}
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "sykero_io.hpp"
+
+namespace sl::uevent
+{
+	// Points into the buffer of the monitor, so it is valid only until the next receive
+	struct event
+	{
+		std::string_view action;
+		std::string_view subsystem;
+		std::string_view devpath;
+		std::string_view devname;
+	};
+
+	// The action of the event which is received when the socket buffer has overflowed, i.e. when any event may have been lost
+	constexpr std::string_view ACTION_LOST = "lost";
+
+	// Receives kernel uevents from netlink, or from a local datagram socket which stands in for it, e.g. in the simulation.
+	// Both carry the same datagrams: "ACTION@DEVPATH" followed by KEY=VALUE pairs, each terminated by a null character.
+	class monitor final : public io::file_descriptor
+	{
+	public:
+		monitor();
+		explicit monitor(const std::filesystem::path& path);
+		~monitor();
+
+		SL_NON_COPYABLE(monitor);
+
+		// Returns false when there are no more pending events
+		bool receive(event& e);
+
+	private:
+		std::filesystem::path _path;
+		std::array<char, 0x2000> _buffer;
+	};
+}
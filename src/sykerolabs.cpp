@@ -8,6 +8,20 @@
 #include "sykero_csv.hpp"
 #include "sykero_time.hpp"
 #include "sykero_mppt.hpp"
+#include "sykero_stats.hpp"
+#include "sykero_metrics.hpp"
+#include "sykero_trace.hpp"
+#include "sykero_sim.hpp"
+#include "sykero_uevent.hpp"
+#include "sykero_devices.hpp"
+#include "sykero_alloc.hpp"
+#include "sykero_footprint.hpp"
+#include "sykero_control.hpp"
+#include "sykero_power.hpp"
+#include "sykero_shm.hpp"
+
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 
 namespace sl
 {
@@ -42,7 +56,7 @@ namespace sl
 				return;
 			}
 
-			log_notice("float switch %zu changed to %s.", ++index, state ? "high" : "low");
+			log_notice("float switch %u changed to %s.", ++index, state ? "high" : "low");
 		}
 	};
 
@@ -51,6 +65,9 @@ namespace sl
 		uint32_t fan1_rpm = 0;
 		uint32_t fan2_rpm = 0;
 
+		// Counts the readings of each fan, so that a fan which has stopped sending pulses is told apart from one which keeps its speed
+		std::array<uint32_t, 2> readings = {};
+
 		void save(uint32_t index, uint32_t rpm)
 		{
 			switch (index)
@@ -62,9 +79,23 @@ namespace sl
 				fan2_rpm = rpm;
 				break;
 			default:
-				log_error("invalid fan index %zu", index);
+				log_error("invalid fan index %u", index);
 				return;
 			}
+
+			++readings[index];
+		}
+
+		uint32_t rpm(uint32_t index) const
+		{
+			return index ? fan2_rpm : fan1_rpm;
+		}
+
+		// Not a reading, the fans are not read while they are off
+		void stop()
+		{
+			fan1_rpm = 0;
+			fan2_rpm = 0;
 		}
 	};
 
@@ -74,18 +105,235 @@ namespace sl
 		snapshot<uint32_t, std::deci> pool2;
 	};
 
-	property_group<pump_properties> pump_data;
-	property_group<float_switch_properties> float_switch_data;
-	property_group<fan_properties> fan_data;
+	struct sensor_properties
+	{
+		rollup<float, std::milli> cpu_temperature;
+		rollup<float, std::milli> air_temperature;
+		rollup<float> air_humidity; // relative percent
+		rollup<float> air_pressure; // hectopascal
+
+		// The window is defined by time, so the average does not depend on the sampling rate as long as the capacity holds one window
+		// of samples. The capacity is for AIR_TEMPERATURE_SAMPLE_INTERVAL, which the power tiers only lengthen.
+		windowed_average<FAN_CONTROL_AVERAGE_CAPACITY, float, std::milli> fan_control_temperature{ FAN_CONTROL_AVERAGE_WINDOW };
+	};
+
+	// Updated from the minute tick and from the float switch thread, so every update must hold pump_mutex
+	seqlock_property_group<pump_properties> pump_data;
+	seqlock_property_group<float_switch_properties> float_switch_data;
+	seqlock_property_group<fan_properties> fan_data;
 	property_group<tds_properties> tds_data;
 
-	void monitor_float_switches(std::stop_source stop_source, const gpio::line_group& float_switches)
+	// Set by the fan controller while the relay or the tachometers are off, when the tachometer thread publishes 0 RPM and ignores the edges
+	std::atomic<bool> fans_idle = true;
+
+	// How late the minute tick fires and how long each phase of it takes, in microseconds
+	struct tick_statistics
+	{
+		metrics::histogram lateness{ "sykerolabs_tick_lateness_microseconds", "How late the minute tick fires" };
+		metrics::histogram acquisition{ "sykerolabs_tick_acquisition_microseconds", "Duration of the sensor summaries of the minute tick" };
+		metrics::histogram actuation{ "sykerolabs_tick_actuation_microseconds", "Duration of the pump relay adjustments of the minute tick" };
+		metrics::histogram csv{ "sykerolabs_tick_csv_microseconds", "Duration of the CSV row of the minute tick" };
+
+		void log() const
+		{
+			lateness.log("tick lateness");
+			acquisition.log("tick acquisition");
+			actuation.log("tick actuation");
+			csv.log("tick csv");
+		}
+	};
+
+	tick_statistics tick_stats;
+
+	// How long the edges waited in the kernel before they were read, i.e. mostly the scheduling latency of the reading thread
+	struct event_statistics
+	{
+		metrics::histogram float_switches{ "sykerolabs_float_switch_event_latency_microseconds", "Delay from a float switch edge to its handling" };
+		metrics::histogram tachometers{ "sykerolabs_tachometer_event_latency_microseconds", "Delay from a tachometer edge to its handling" };
+		metrics::histogram interlock{ "sykerolabs_interlock_latency_microseconds", "Delay from a dry float switch edge to its pump relay being cut" };
+
+		void log() const
+		{
+			float_switches.log("float switch event latency");
+			tachometers.log("tachometer event latency");
+			interlock.log("interlock latency");
+		}
+	};
+
+	event_statistics event_stats;
+
+	// The line events are timestamped with CLOCK_MONOTONIC, which is the steady clock on Linux
+	std::chrono::nanoseconds event_latency(const gpio_v2_line_event& event)
+	{
+		return std::chrono::steady_clock::now().time_since_epoch() - std::chrono::nanoseconds(event.timestamp_ns);
+	}
+
+	// A gauge whose value is also published to the live state segment
+	class live_gauge
+	{
+	public:
+		live_gauge(sykerolabs_shm_value index, const char* name, const char* help, const char* labels = nullptr) :
+			_gauge(name, help, labels),
+			_index(index)
+		{
+		}
+
+		SL_NON_COPYABLE(live_gauge);
+
+		void set(double value)
+		{
+			_gauge.set(value);
+			shm::publish(_index, value);
+		}
+
+	private:
+		metrics::gauge _gauge;
+		const sykerolabs_shm_value _index;
+	};
+
+	// A gauge per smoothing horizon of an MPPT value, see mppt::SMOOTHING_HORIZONS
+	class smoothed_gauges
+	{
+	public:
+		smoothed_gauges(const char* name, const char* help) :
+			_gauges
+			{
+				metrics::gauge(name, help, mppt::SMOOTHING_HORIZON_LABELS[0]),
+				metrics::gauge(name, help, mppt::SMOOTHING_HORIZON_LABELS[1]),
+				metrics::gauge(name, help, mppt::SMOOTHING_HORIZON_LABELS[2])
+			}
+		{
+		}
+
+		SL_NON_COPYABLE(smoothed_gauges);
+
+		static_assert(mppt::SMOOTHING_HORIZONS.size() == 3, "a gauge per horizon");
+
+		void set(const mppt::smoothed_values& values)
+		{
+			for (size_t i = 0; i < _gauges.size(); ++i)
+			{
+				_gauges[i].set(values[i]);
+			}
+		}
+
+	private:
+		std::array<metrics::gauge, mppt::SMOOTHING_HORIZONS.size()> _gauges;
+	};
+
+	// The latest values of the property groups for the metrics server and the live state segment. The sensors expose the mean of the current minute.
+	struct property_gauges
+	{
+		live_gauge cpu_temperature{ SYKEROLABS_SHM_CPU_TEMPERATURE, "sykerolabs_cpu_temperature_celsius", "CPU temperature" };
+		live_gauge air_temperature{ SYKEROLABS_SHM_AIR_TEMPERATURE, "sykerolabs_air_temperature_celsius", "Air temperature" };
+		live_gauge air_humidity{ SYKEROLABS_SHM_AIR_HUMIDITY, "sykerolabs_air_humidity_percent", "Relative air humidity" };
+		live_gauge air_pressure{ SYKEROLABS_SHM_AIR_PRESSURE, "sykerolabs_air_pressure_hectopascals", "Air pressure" };
+		live_gauge water_level_sensor1{ SYKEROLABS_SHM_WATER_LEVEL_SENSOR_1, "sykerolabs_water_level_sensor", "Float switch state, 1 is high", "sensor=\"1\"" };
+		live_gauge water_level_sensor2{ SYKEROLABS_SHM_WATER_LEVEL_SENSOR_2, "sykerolabs_water_level_sensor", "Float switch state, 1 is high", "sensor=\"2\"" };
+		live_gauge pump1{ SYKEROLABS_SHM_PUMP_1, "sykerolabs_pump", "Pump state, 1 is on", "pump=\"1\"" };
+		live_gauge pump2{ SYKEROLABS_SHM_PUMP_2, "sykerolabs_pump", "Pump state, 1 is on", "pump=\"2\"" };
+		live_gauge fan_duty_percent{ SYKEROLABS_SHM_FAN_DUTY_PERCENT, "sykerolabs_fan_duty_percent", "Fan PWM duty cycle" };
+		live_gauge fan1_rpm{ SYKEROLABS_SHM_FAN_1_RPM, "sykerolabs_fan_rpm", "Fan speed", "fan=\"1\"" };
+		live_gauge fan2_rpm{ SYKEROLABS_SHM_FAN_2_RPM, "sykerolabs_fan_rpm", "Fan speed", "fan=\"2\"" };
+		metrics::gauge fan_target_rpm{ "sykerolabs_fan_target_rpm", "Target fan speed of the controller" };
+		metrics::gauge fan1_stalled{ "sykerolabs_fan_stalled", "Fan stall state, 1 is stalled", "fan=\"1\"" };
+		metrics::gauge fan2_stalled{ "sykerolabs_fan_stalled", "Fan stall state, 1 is stalled", "fan=\"2\"" };
+		live_gauge pool1_ec{ SYKEROLABS_SHM_POOL_1_EC, "sykerolabs_pool_ec", "Raw electrical conductivity reading of the pool", "pool=\"1\"" };
+		live_gauge pool2_ec{ SYKEROLABS_SHM_POOL_2_EC, "sykerolabs_pool_ec", "Raw electrical conductivity reading of the pool", "pool=\"2\"" };
+		live_gauge battery_voltage{ SYKEROLABS_SHM_BATTERY_VOLTAGE, "sykerolabs_battery_volts", "Battery voltage" };
+		live_gauge battery_current{ SYKEROLABS_SHM_BATTERY_CURRENT, "sykerolabs_battery_amperes", "Battery current" };
+		live_gauge panel_voltage{ SYKEROLABS_SHM_PANEL_VOLTAGE, "sykerolabs_panel_volts", "Panel voltage" };
+		live_gauge panel_power{ SYKEROLABS_SHM_PANEL_POWER, "sykerolabs_panel_watts", "Panel power" };
+		live_gauge load_current{ SYKEROLABS_SHM_LOAD_CURRENT, "sykerolabs_load_amperes", "MPPT load current" };
+		live_gauge mppt_state{ SYKEROLABS_SHM_MPPT_STATE, "sykerolabs_mppt_state", "MPPT state of operation" };
+		live_gauge mppt_error{ SYKEROLABS_SHM_MPPT_ERROR, "sykerolabs_mppt_error", "MPPT error code" };
+		live_gauge yield_total{ SYKEROLABS_SHM_YIELD_TOTAL, "sykerolabs_mppt_yield_total_kilowatt_hours", "MPPT total yield" };
+		live_gauge max_power_today{ SYKEROLABS_SHM_MAX_POWER_TODAY, "sykerolabs_mppt_max_power_today_watts", "MPPT maximum power today" };
+		smoothed_gauges smoothed_battery_voltage{ "sykerolabs_battery_volts_smoothed", "Time decayed average of the battery voltage" };
+		smoothed_gauges smoothed_battery_current{ "sykerolabs_battery_amperes_smoothed", "Time decayed average of the battery current" };
+		smoothed_gauges smoothed_panel_voltage{ "sykerolabs_panel_volts_smoothed", "Time decayed average of the panel voltage" };
+		smoothed_gauges smoothed_panel_power{ "sykerolabs_panel_watts_smoothed", "Time decayed average of the panel power" };
+		smoothed_gauges smoothed_load_current{ "sykerolabs_load_amperes_smoothed", "Time decayed average of the MPPT load current" };
+
+		void set(const mppt::mppt_values& md)
+		{
+			battery_voltage.set(md.battery_voltage);
+			battery_current.set(md.battery_current);
+			panel_voltage.set(md.panel_voltage);
+			panel_power.set(md.panel_power);
+			load_current.set(md.load_current);
+			mppt_state.set(md.state);
+			mppt_error.set(md.error);
+			yield_total.set(md.yield_total);
+			max_power_today.set(md.max_power_today);
+			smoothed_battery_voltage.set(md.smoothed_battery_voltage);
+			smoothed_battery_current.set(md.smoothed_battery_current);
+			smoothed_panel_voltage.set(md.smoothed_panel_voltage);
+			smoothed_panel_power.set(md.smoothed_panel_power);
+			smoothed_load_current.set(md.smoothed_load_current);
+		}
+	};
+
+	property_gauges gauges;
+
+	// The pumps are switched from the minute tick and cut from the float switch edges. Serializes the relay writes and the updates of pump_data.
+	std::mutex pump_mutex;
+
+	// Latched when the float switch of a pool reports it dry, released when it reports water again.
+	// A latched pump stays off whatever the irrigation schedule says.
+	std::array<std::atomic<bool>, 2> pump_interlocks = {};
+
+	constexpr std::array<uint32_t, 2> PUMP_RELAYS = { pins::PUMP_1_RELAY, pins::PUMP_2_RELAY };
+
+	// Called from the float switch thread, so the pump is cut without waiting for the scheduler
+	void interlock_pump(const gpio::line_group& irrigation_pumps, size_t index, bool level)
+	{
+		if (index >= pump_interlocks.size())
+		{
+			return;
+		}
+
+		if (level != WATER_LEVEL_DRY)
+		{
+			if (pump_interlocks[index].exchange(false))
+			{
+				log_notice("pump %zu interlock released, its pool has water again.", index + 1);
+			}
+
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(pump_mutex);
+
+			pump_interlocks[index] = true;
+
+			// The relays are active low
+			irrigation_pumps.write_value(gpio::line_value_pair(PUMP_RELAYS[index], true));
+
+			pump_data.update([&](pump_properties& pumps)
+			{
+				(index == 0 ? pumps.pump1 : pumps.pump2) = false;
+			});
+
+			(index == 0 ? gauges.pump1 : gauges.pump2).set(false);
+		}
+
+		log_warning("pump %zu cut, its pool is dry.", index + 1);
+	}
+
+	void monitor_float_switches(const io::stop_event& stop, const gpio::line_group& float_switches, const gpio::line_group& irrigation_pumps)
 	{
 		log_debug("thread %d monitor_float_switches started.", gettid());
+		footprint::register_thread("float switches");
+
+#ifdef SYKEROLABS_REALTIME
+		rt::enter(FLOAT_SWITCH_THREAD);
+#endif
 
 		try
 		{
-			std::stop_token stop_token = stop_source.get_token();
+			const std::stop_token& stop_token = stop.token();
 
 			{
 				std::array<gpio::line_value_pair, 2> data =
@@ -96,9 +344,18 @@ namespace sl
 
 				float_switches.read_values(data);
 
-				auto fsd = float_switch_data.acquire();
-				fsd->sensor1 = data[0].value;
-				fsd->sensor2 = data[1].value;
+				float_switch_data.update([&](float_switch_properties& fsd)
+				{
+					fsd.sensor1 = data[0].value;
+					fsd.sensor2 = data[1].value;
+				});
+
+				gauges.water_level_sensor1.set(data[0].value);
+				gauges.water_level_sensor2.set(data[1].value);
+
+				// A pool may be dry already when started
+				interlock_pump(irrigation_pumps, 0, data[0].value);
+				interlock_pump(irrigation_pumps, 1, data[1].value);
 			}
 
 			gpio_v2_line_event event;
@@ -106,10 +363,31 @@ namespace sl
 
 			while (!stop_token.stop_requested())
 			{
-				while (float_switches.poll(std::chrono::milliseconds(100)) && float_switches.read_event(event))
+				while (float_switches.poll(stop) && float_switches.read_event(event))
 				{
-					auto fsd = float_switch_data.acquire();
-					fsd->save(event.offset, event.id);
+					const bool level = event.id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+					interlock_pump(irrigation_pumps, event.offset - pins::WATER_LEVEL_SENSOR_1, level);
+
+					if (level == WATER_LEVEL_DRY)
+					{
+						const auto latency = event_latency(event);
+						event_stats.interlock.record(latency);
+
+						if (latency > INTERLOCK_LATENCY_TARGET)
+						{
+							log_warning("pump cut %lld us after the edge.",
+								static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+						}
+					}
+
+					event_stats.float_switches.record(event_latency(event));
+
+					float_switch_data.update([&](float_switch_properties& fsd)
+					{
+						fsd.save(event.offset, event.id);
+						gauges.water_level_sensor1.set(fsd.sensor1);
+						gauges.water_level_sensor2.set(fsd.sensor2);
+					});
 				}
 
 				std::this_thread::yield();
@@ -127,41 +405,69 @@ namespace sl
 		log_debug("thread %d monitor_float_switches stopped.", gettid());
 	}
 
-	void measure_fans(std::stop_source stop_source, const gpio::line_group& fan_tachometers)
+	// The only writer of fan_data. The fan controller wakes it when the fans go idle.
+	void measure_fans(const io::wakeup_event& wakeup, const gpio::line_group& fan_tachometers)
 	{
 		log_debug("thread %d measure_fans started.", gettid());
+		footprint::register_thread("tachometers");
+
+#ifdef SYKEROLABS_REALTIME
+		rt::enter(FAN_TACHOMETER_THREAD);
+#endif
 
 		try
 		{
-			std::stop_token stop_token = stop_source.get_token();
-
 			gpio_v2_line_event event;
 			mem::clear(event);
 
+			// Counts the pulses per minute
 			frequency_counter<float, std::chrono::minutes> fan_speeds[2];
 
-			while (!stop_token.stop_requested())
+			while (!wakeup.stop_requested())
 			{
-				while (fan_tachometers.poll(std::chrono::milliseconds(100)) && fan_tachometers.read_event(event))
+				while (fan_tachometers.poll(wakeup) && fan_tachometers.read_event(event))
 				{
+					event_stats.tachometers.record(event_latency(event));
+
 					const auto time = std::chrono::nanoseconds(event.timestamp_ns);
 					const uint32_t fan_index = event.offset - pins::FAN_1_TACHOMETER;
 					auto& fan_speed = fan_speeds[fan_index];
 
-					if (event.line_seqno % 10 != 0)
+					// E.g. the fans coasting after the relay was turned off
+					if (fans_idle.load(std::memory_order_acquire))
+					{
+						fan_speed.reset();
+					}
+					else if (event.line_seqno % 10 != 0)
 					{
 						fan_speed.update(time);
 					}
 					else
 					{
-						const float rpm = fan_speed.get(time);
+						const float rpm = fan_speed.get(time) / FAN_TACHOMETER_PULSES_PER_REVOLUTION;
 						fan_speed.reset();
 
-						auto fd = fan_data.acquire();
-						fd->save(event.offset, static_cast<uint32_t>(rpm));
+						fan_data.update([&](fan_properties& fd)
+						{
+							fd.save(fan_index, static_cast<uint32_t>(rpm));
+							gauges.fan1_rpm.set(fd.fan1_rpm);
+							gauges.fan2_rpm.set(fd.fan2_rpm);
+						});
 					}
 				}
 
+				wakeup.consume();
+
+				if (fans_idle.load(std::memory_order_acquire))
+				{
+					fan_data.update([](fan_properties& fd)
+					{
+						fd.stop();
+						gauges.fan1_rpm.set(fd.fan1_rpm);
+						gauges.fan2_rpm.set(fd.fan2_rpm);
+					});
+				}
+
 				std::this_thread::yield();
 			}
 		}
@@ -177,69 +483,88 @@ namespace sl
 		log_debug("thread %d measure_fans stopped.", gettid());
 	}
 
-	void measure_tds(std::stop_source stop_source, const gpio::line_group& tds_probe_relay, io::file_descriptor& pool1_ec_file, io::file_descriptor& pool2_ec_file)
-	{
-		log_debug("thread %d measure_tds started.", gettid());
+	// The device supervisor counts the serial ports the kernel has reported, so that monitor_mppt knows when to retry
+	std::mutex serial_mutex;
+	std::condition_variable_any serial_added;
+	uint64_t serial_generation = 0;
 
-		constexpr gpio::line_value_pair PROBES_ON(pins::TDS_PROBE_RELAY, false);
-		constexpr gpio::line_value_pair PROBES_OFF(pins::TDS_PROBE_RELAY, true);
-
-		try
+	void notify_serial_added()
+	{
 		{
-			std::stop_token stop_token = stop_source.get_token();
+			std::lock_guard<std::mutex> lock(serial_mutex);
+			++serial_generation;
+		}
 
-			do
-			{
-				tds_probe_relay.write_value(PROBES_ON);
+		serial_added.notify_all();
+	}
 
-				// The sampling interval is 8 times in a second, see datarate parameters in
-				// https://github.com/visuve/SykeroLabs3/wiki/Operating-system-configuration#full-bootfirmwareconfigtxt
-				std::this_thread::sleep_for(TDS_PROBE_WAKEUP_DELAY);
+	void reopen_mppt(std::stop_token stop_token, mppt::controller& mppt)
+	{
+		const auto lost = std::chrono::steady_clock::now();
 
-				{
-					auto tds = tds_data.acquire();
-					tds->pool1.parse(io::peek_some(pool1_ec_file)).commit();
-					tds->pool2.parse(io::peek_some(pool2_ec_file)).commit();
-				}
+		while (!stop_token.stop_requested())
+		{
+			uint64_t generation = 0;
+			{
+				std::lock_guard<std::mutex> lock(serial_mutex);
+				generation = serial_generation;
+			}
 
-				tds_probe_relay.write_value(PROBES_OFF);
+			try
+			{
+				mppt.reopen(paths::SERIAL0);
 
-				// Sleep/wait for the next measurement
-				for (std::chrono::seconds i(0); i < TDS_READ_INTERVAL && !stop_token.stop_requested(); ++i)
-				{
-					std::this_thread::yield();
-					std::this_thread::sleep_for(std::chrono::seconds(1));
-				}
+				const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lost);
+				log_notice("mppt::controller reopened after %lld ms.", static_cast<long long>(elapsed.count()));
+				return;
+			}
+			catch (const std::system_error& e)
+			{
+				log_debug("mppt::controller not reopened: %s.", e.what());
+			}
 
-			} while (!stop_token.stop_requested());
+			std::unique_lock<std::mutex> lock(serial_mutex);
 
+			serial_added.wait_for(lock, stop_token, SERIAL_REOPEN_INTERVAL, [generation]
+			{
+				return serial_generation != generation;
+			});
 		}
-		catch (const std::system_error& e)
-		{
-			log_critical("std::system_error: %s", e.what());
-		}
-		catch (const std::exception& e)
-		{
-			log_critical("std::exception: %s", e.what());
-		}
-
-		log_debug("thread %d measure_tds stopped.", gettid());
 	}
 
-	void monitor_mppt(std::stop_source stop_source, mppt::controller& mppt)
+	void monitor_mppt(const io::stop_event& stop, mppt::controller& mppt)
 	{
 		log_debug("thread %d monitor_mppt started.", gettid());
+		footprint::register_thread("mppt");
+
+#ifdef SYKEROLABS_REALTIME
+		rt::enter(MPPT_THREAD);
+#endif
 
 		try
 		{
-			std::stop_token stop_token = stop_source.get_token();
+			const std::stop_token& stop_token = stop.token();
 			std::array<uint8_t, MAX_SERIAL_BUFFER_SIZE> buffer;
 			std::chrono::steady_clock::time_point last_valid_block = std::chrono::steady_clock::now();
 			std::chrono::steady_clock::time_point last_warning = last_valid_block - std::chrono::minutes(1);
 
 			while (!stop_token.stop_requested())
 			{
-				auto data = mppt.read_serial(buffer);
+				std::span<uint8_t> data;
+
+				try
+				{
+					data = mppt.read_serial(buffer, stop);
+				}
+				catch (const std::system_error& e)
+				{
+					log_error("mppt::controller lost: %s.", e.what());
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+					const alloc::exemption hotplug;
+#endif
+					reopen_mppt(stop_token, mppt);
+					continue;
+				}
 
 				if (data.empty())
 				{
@@ -253,6 +578,7 @@ namespace sl
 				if (mppt.parse(data))
 				{
 					last_valid_block = now;
+					gauges.set(mppt.mppt_data.acquire()->values());
 				}
 
 				const auto since_valid = now - last_valid_block;
@@ -261,7 +587,7 @@ namespace sl
 				if (since_valid >= std::chrono::minutes(1) && since_warning >= std::chrono::minutes(1))
 				{
 					const auto minutes = std::chrono::duration_cast<std::chrono::minutes>(since_valid);
-					log_warning("no valid block received since %lld minutes", minutes.count());
+					log_warning("no valid block received since %lld minutes", static_cast<long long>(minutes.count()));
 					last_warning = now;
 				}
 			} 
@@ -280,8 +606,12 @@ namespace sl
 
 	void toggle_irrigation(const gpio::line_group& irrigation_pumps, int minute)
 	{
-		const bool pump1 = minute % 10 == 0;
-		const bool pump2 = minute % 10 == 5;
+		SL_TRACE_SPAN("toggle_irrigation");
+
+		std::lock_guard<std::mutex> lock(pump_mutex);
+
+		const bool pump1 = minute % 10 == 0 && !pump_interlocks[0];
+		const bool pump2 = minute % 10 == 5 && !pump_interlocks[1];
 
 		const std::array<gpio::line_value_pair, 2> states =
 		{
@@ -291,45 +621,243 @@ namespace sl
 
 		irrigation_pumps.write_values(states);
 
-		auto pumps = pump_data.acquire();
-		pumps->pump1 = pump1;
-		pumps->pump2 = pump2;
+		pump_data.update([&](pump_properties& pumps)
+		{
+			pumps.pump1 = pump1;
+			pumps.pump2 = pump2;
+		});
+
+		gauges.pump1.set(pump1);
+		gauges.pump2.set(pump2);
 	}
 
-	float adjust_fans(const gpio::line_group& fan_relay, pwm::chip& pwm, float temperature)
+	// Tracks a target speed derived from the air temperature with the tachometer readings, once per FAN_CONTROL_INTERVAL or its multiple.
+	// Without the tachometers, the feed-forward alone sets the duty cycle. The relay and the duty cycle are written only when they change.
+	class fan_controller final
 	{
-		float duty_percent = DUTY_PERCENTAGE_INVALID;
+	public:
+		fan_controller(const gpio::line_group& relay, pwm::chip& pwm, const io::wakeup_event& tachometers) :
+			_relay(relay),
+			_pwm(pwm),
+			_tachometers(tachometers)
+		{
+		}
+
+		SL_NON_COPYABLE(fan_controller);
+
+		// ABSOLUTE_ZERO turns the fans off, e.g. at night. The interval is the time since the previous update.
+		void update(float temperature, std::chrono::nanoseconds interval)
+		{
+			SL_TRACE_SPAN("fan_controller::update");
+
+			if (temperature <= MIN_FAN_TOGGLE_CELCIUS)
+			{
+				if (_on)
+				{
+					stop();
+				}
+
+				return;
+			}
 
-		const gpio::line_value_pair state(pins::FAN_RELAY, !(temperature > MIN_FAN_TOGGLE_CELCIUS));
+			if (!_on && temperature < MIN_FAN_TOGGLE_CELCIUS + FAN_TOGGLE_HYSTERESIS_CELCIUS)
+			{
+				return;
+			}
+
+			const fan_properties fd = fan_data.snapshot();
+
+			// The readings from before, e.g. while the fans were coasting or the tachometers were off, do not count
+			if (!_on || _resync)
+			{
+				_readings = fd.readings;
+				_reported = {};
+				_silent = {};
+				_resync = false;
+			}
+
+			const float above = std::min(temperature, MAX_FAN_TOGGLE_CELCIUS) - MIN_FAN_TOGGLE_CELCIUS;
+			const float target_rpm = FAN_MIN_RPM + above * FAN_RPM_STEP;
+			const float feed_forward = above * FAN_TEMPERATURE_STEP;
+
+			float measured_rpm = 0.0f;
+			uint32_t measured = 0;
+			uint32_t stalled = 0;
+
+			for (uint32_t index = 0; _closed_loop && index < _readings.size(); ++index)
+			{
+				if (watch(fd, index, interval))
+				{
+					measured_rpm += static_cast<float>(fd.rpm(index));
+					++measured;
+				}
+
+				stalled += _stalled[index];
+			}
+
+			float duty_percent = feed_forward;
+
+			if (measured)
+			{
+				duty_percent = _pi.update(target_rpm, measured_rpm / measured, feed_forward, interval);
+			}
+			else if (_closed_loop && stalled == _stalled.size())
+			{
+				// Nothing to control with, the full duty may get the fans going again
+				duty_percent = DUTY_PERCENTAGE_MAX;
+			}
+
+			actuate(true, duty_percent);
+			gauges.fan_target_rpm.set(target_rpm);
+		}
+
+		// Writes the relay regardless of the state it is thought to be in, e.g. on start and on exit
+		void stop()
+		{
+			_on = true;
+			_duty_percent = DUTY_PERCENTAGE_INVALID;
+			_pi.reset();
+
+			actuate(false, DUTY_PERCENTAGE_MIN);
+			gauges.fan_target_rpm.set(0.0f);
+		}
+
+		// E.g. when the tachometers are turned off to save power. The stall states are kept until the fans are read again.
+		void closed_loop(bool enabled)
+		{
+			_resync = _resync || (enabled && !_closed_loop);
+			_closed_loop = enabled;
+			_pi.reset();
+			publish_idle();
+		}
+
+		bool on() const
+		{
+			return _on;
+		}
+
+		float duty_percent() const
+		{
+			return _duty_percent;
+		}
+
+	private:
+		// Returns true if the fan has a speed to control with, i.e. it has been read since the relay was turned on and has not stalled
+		bool watch(const fan_properties& fd, uint32_t index, std::chrono::nanoseconds interval)
+		{
+			const bool fresh = fd.readings[index] != _readings[index];
+			_readings[index] = fd.readings[index];
+			_reported[index] = _reported[index] || fresh;
+
+			if (fresh && fd.rpm(index) >= FAN_STALL_RPM)
+			{
+				_silent[index] = std::chrono::nanoseconds(0);
+
+				if (_stalled[index])
+				{
+					_stalled[index] = false;
+					stall_gauge(index).set(0);
+					log_notice("fan %u spinning again at %u RPM.", index + 1, fd.rpm(index));
+				}
+			}
+			else
+			{
+				_silent[index] += interval;
+
+				if (!_stalled[index] && _silent[index] >= FAN_STALL_TIMEOUT)
+				{
+					_stalled[index] = true;
+					stall_gauge(index).set(1);
+					log_warning("fan %u stalled, %u RPM and no reading above %.0f RPM in %lld s.",
+						index + 1,
+						fd.rpm(index),
+						FAN_STALL_RPM,
+						static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(_silent[index]).count()));
+				}
+			}
+
+			return _reported[index] && !_stalled[index];
+		}
 
-		if (temperature <= MIN_FAN_TOGGLE_CELCIUS)
+		void actuate(bool on, float duty_percent)
 		{
-			duty_percent = DUTY_PERCENTAGE_MIN;
+			duty_percent = std::clamp(duty_percent, DUTY_PERCENTAGE_MIN, DUTY_PERCENTAGE_MAX);
+
+			if (on != _on)
+			{
+				_relay.write_value(gpio::line_value_pair(pins::FAN_RELAY, !on));
+				_on = on;
+				shm::publish(SYKEROLABS_SHM_FAN_RELAY, on);
+				publish_idle();
+			}
+
+			const bool limit = duty_percent == DUTY_PERCENTAGE_MIN || duty_percent == DUTY_PERCENTAGE_MAX;
 
+			if (duty_percent != _duty_percent && (limit || std::abs(duty_percent - _duty_percent) >= FAN_DUTY_DEADBAND_PERCENT))
+			{
+				_pwm.set_duty_percent(duty_percent);
+				_duty_percent = duty_percent;
+				gauges.fan_duty_percent.set(duty_percent);
+			}
 		}
-		else if (temperature >= MAX_FAN_TOGGLE_CELCIUS)
+
+		// Without the relay or the tachometers the speeds read 0, see measure_fans
+		void publish_idle()
 		{
-			duty_percent = DUTY_PERCENTAGE_MAX;
+			const bool idle = !_on || !_closed_loop;
+
+			if (fans_idle.exchange(idle, std::memory_order_release) != idle && idle)
+			{
+				_tachometers.signal();
+			}
 		}
-		else
+
+		metrics::gauge& stall_gauge(uint32_t index)
 		{
-			duty_percent = (temperature - MIN_FAN_TOGGLE_CELCIUS) * FAN_TEMPERATURE_STEP;
+			return index ? gauges.fan2_stalled : gauges.fan1_stalled;
 		}
 
-		pwm.set_duty_percent(duty_percent);
-		fan_relay.write_value(state);
+		const gpio::line_group& _relay;
+		pwm::chip& _pwm;
+		const io::wakeup_event& _tachometers;
+		control::pi_controller _pi{ FAN_PROPORTIONAL_GAIN, FAN_INTEGRAL_GAIN, DUTY_PERCENTAGE_MIN, DUTY_PERCENTAGE_MAX };
 
-		return duty_percent;
+		bool _on = false;
+		bool _closed_loop = true;
+		bool _resync = false;
+		float _duty_percent = DUTY_PERCENTAGE_INVALID;
+
+		std::array<uint32_t, 2> _readings = {};
+		std::array<std::chrono::nanoseconds, 2> _silent = {};
+		std::array<bool, 2> _reported = {};
+		std::array<bool, 2> _stalled = {};
+	};
+
+	// SIGINT and SIGTERM are blocked in every thread and read from a signalfd by the scheduler,
+	// so that the stop callbacks run on a normal thread instead of inside a signal handler
+	sigset_t stop_signals()
+	{
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		return signals;
 	}
 
-	void signal_handler(int signal)
+#ifdef SYKEROLABS_TRACE
+	void trace_signal_handler(int)
 	{
-		log_notice("signaled: %d.", signal);
-		common_stop_source.request_stop();
+		trace::request_dump();
 	}
+#endif
 
-	std::filesystem::path csv_file_timestamped_path()
+	std::filesystem::path csv_file_timestamped_path(
+		time::timestamp_formatter& timestamps,
+		std::chrono::system_clock::time_point time_point = time::clock::now())
 	{
+#ifdef SYKEROLABS_SIMULATION
+		const std::filesystem::path home(paths::ROOT);
+#else
 #ifndef NDEBUG
 		if (isatty(STDOUT_FILENO) == 1)
 		{
@@ -337,6 +865,7 @@ namespace sl
 		}
 #endif
 		const std::filesystem::path home(getenv("HOME"));
+#endif
 
 		const auto sykerolabs = home / "sykerolabs";
 
@@ -345,48 +874,164 @@ namespace sl
 			std::filesystem::create_directory(sykerolabs);
 		}
 
-		return sykerolabs / (time::date_string() + ".csv");
+		char date[time::timestamp_formatter::DATE_LENGTH];
+
+		std::string file_name(timestamps.date(time_point, date));
+		file_name += ".csv";
+
+		return sykerolabs / file_name;
+	}
+
+#ifdef SYKEROLABS_TRACE
+	std::filesystem::path trace_path(std::chrono::system_clock::time_point time_point)
+	{
+		const std::filesystem::path home(getenv("HOME"));
+
+		char millis[time::timestamp_formatter::EPOCH_MILLIS_LENGTH];
+
+		std::string file_name("trace-");
+		file_name += time::timestamp_formatter::epoch_millis(time_point, millis);
+		file_name += ".json";
+
+		return home / "sykerolabs" / file_name;
 	}
+#endif
+
+#ifdef SYKEROLABS_SIMULATION
+	// Stands in for the netlink socket, see uevent::monitor
+	std::filesystem::path uevent_socket_path()
+	{
+		return paths::ROOT / "uevent.sock";
+	}
+#endif
+
+	// Logs how long a phase of the startup took
+	class phase_timer final
+	{
+	public:
+		explicit phase_timer(const char* name) :
+			_name(name),
+			_started(std::chrono::steady_clock::now())
+		{
+		}
+
+		~phase_timer()
+		{
+			const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _started);
+			log_info("startup phase %s took %lld us.", _name, static_cast<long long>(elapsed.count()));
+		}
+
+		SL_NON_COPYABLE(phase_timer);
 
-	std::filesystem::path find_iio_device(const std::string_view expected_name)
+	private:
+		const char* _name;
+		const std::chrono::steady_clock::time_point _started;
+	};
+
+	// Logs the time from the stop request until it is destroyed, i.e. until every thread has been joined and every device closed
+	class shutdown_timer final
 	{
-		std::string name_buffer(0x80, '\0');
+	public:
+		explicit shutdown_timer(std::stop_token stop_token) :
+			_callback(stop_token, record(_requested))
+		{
+		}
 
-		for (size_t i = 0; i < MAX_IIO_DEVICES; ++i)
+		~shutdown_timer()
 		{
-			const std::filesystem::path device_name_path = paths::IIO_DEVICE.string() + std::to_string(i) + "/name";
+			const auto requested = std::chrono::steady_clock::duration(_requested.load());
 
-			if (!std::filesystem::exists(device_name_path))
+			if (requested.count() == 0)
 			{
-				log_warning("%s does not exist, skipping.", device_name_path.c_str());
-				continue;
+				return;
 			}
 
-			io::file_descriptor device_name_file(device_name_path);
+			const auto elapsed = std::chrono::steady_clock::now().time_since_epoch() - requested;
+			const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+			log_info("shutdown took %lld us.", static_cast<long long>(micros.count()));
+		}
+
+		SL_NON_COPYABLE(shutdown_timer);
 
-			size_t bytes_read = device_name_file.read_text(name_buffer);
+	private:
+		// Runs in whichever thread requests the stop
+		struct record
+		{
+			std::atomic<std::chrono::steady_clock::rep>& requested;
 
-			if (bytes_read && name_buffer.substr(0, bytes_read - 1) == expected_name)
+			void operator()() const noexcept
 			{
-				return device_name_path.parent_path();
+				requested.store(std::chrono::steady_clock::now().time_since_epoch().count());
 			}
-		}
+		};
+
+		std::atomic<std::chrono::steady_clock::rep> _requested = 0;
+		std::stop_callback<record> _callback;
+	};
+
+	// Runs each function in a thread of its own and rethrows the first exception, once all of them have finished
+	template <typename... Functions>
+	void concurrently(Functions&&... functions)
+	{
+		std::array<std::exception_ptr, sizeof...(Functions)> errors;
 
-		const std::string error_message = 
-			std::format("Device {} not found in /sys/bus/iio/devices/iio:device*", expected_name);
+		{
+			size_t i = 0;
+
+			std::array<std::jthread, sizeof...(Functions)> threads =
+			{
+				std::jthread([&error = errors[i++], &functions]
+				{
+					try
+					{
+						functions();
+					}
+					catch (...)
+					{
+						error = std::current_exception();
+					}
+				})...
+			};
+		}
 
-		throw std::runtime_error(error_message);
+		for (const std::exception_ptr& error : errors)
+		{
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+		}
 	}
 
 	void run()
 	{
-		csv::file<24u> csv(csv_file_timestamped_path(),
+		const auto startup_began = std::chrono::steady_clock::now();
+		const shutdown_timer shutdown(common_stop_source.get_token());
+		const io::stop_event stop(common_stop_source.get_token());
+		const io::wakeup_event tachometer_wakeup(common_stop_source.get_token());
+
+#ifdef SYKEROLABS_REALTIME
+		rt::validate_limits(THREAD_PROFILES);
+#endif
+
+		// Used only from the scheduler thread
+		time::timestamp_formatter timestamps;
+
+		csv::file<32u> csv(csv_file_timestamped_path(timestamps),
 		{
 			"Time",
-			"CPU Temperature",
-			"Air Temperature",
-			"Air Humidity",
-			"Air Pressure",
+			"CPU Temperature Min",
+			"CPU Temperature Max",
+			"CPU Temperature Mean",
+			"Air Temperature Min",
+			"Air Temperature Max",
+			"Air Temperature Mean",
+			"Air Humidity Min",
+			"Air Humidity Max",
+			"Air Humidity Mean",
+			"Air Pressure Min",
+			"Air Pressure Max",
+			"Air Pressure Mean",
 			"Water Level Sensor 1",
 			"Water Level Sensor 2",
 			"Pump 1 Relay",
@@ -408,18 +1053,44 @@ namespace sl
 			"MPPT Daily Best"
 		});
 
-		const auto rotate_csv = [&]()
+#ifdef SYKEROLABS_SPARSE_CSV
+		csv.enable_deadbands(
+		{
+			0.0f, // Time, always written
+			0.5f, 0.5f, 0.5f, // CPU temperature, Celsius
+			0.2f, 0.2f, 0.2f, // Air temperature, Celsius
+			1.0f, 1.0f, 1.0f, // Air humidity, relative percent
+			0.5f, 0.5f, 0.5f, // Air pressure, hectopascal
+			0.0f, 0.0f, // Water level sensors
+			0.0f, 0.0f, 0.0f, // Relays
+			1.0f, // Fan duty percent
+			50.0f, 50.0f, // Fan speeds, RPM
+			1.0f, 1.0f, // Pool EC
+			0.05f, 0.05f, // Battery voltage and current
+			0.5f, 1.0f, // Panel voltage and power
+			0.05f, // MPPT load
+			0.0f, 0.0f, 0.0f, 0.0f // MPPT state, error, yield and daily best
+		}, CSV_KEYFRAME_INTERVAL);
+#endif
+
+		// Every periodic task runs on this thread
+		time::scheduler scheduler;
+
+		const auto rotate_csv = [&](time::scheduler::clock::time_point deadline)
 		{
-			csv.initialize(csv_file_timestamped_path());
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			const alloc::exemption daily;
+#endif
+			csv.initialize(csv_file_timestamped_path(timestamps, deadline));
 		};
 
-		const std::chrono::hh_mm_ss first_start = time::time_to_midnight();
 		{
-			const std::string ttm = time::time_string(first_start);
+			const std::string ttm = time::time_string(time::time_to_midnight());
 			log_debug("time to midnight: %s.", ttm.c_str());
 		}
 
-		time::timer csv_rotate_timer(rotate_csv, first_start, LOG_ROTATION_INTERVAL);
+		// Added before the minute tick, so that the midnight row goes into the new file
+		scheduler.add("csv rotation", rotate_csv, time::next_midnight);
 
 		const std::set<uint32_t> water_level_sensor_pins =
 		{
@@ -470,115 +1141,465 @@ namespace sl
 				fan_tachometer_pins,
 				FAN_TACHOMETER_DEBOUNCE);
 
-		pwm::chip fan_pwm(sl::paths::PWM_CHIP, 0, FAN_PWM_CONTROL_FREQUENCY);
+		// Opened before the devices, so that no event in between is missed
+#ifdef SYKEROLABS_SIMULATION
+		uevent::monitor uevents(uevent_socket_path());
+#else
+		uevent::monitor uevents;
+#endif
+
+		// The PWM export, the IIO devices and the serial port may each take a while, but they do not depend on each other
+		std::optional<pwm::chip> fan_pwm_device;
+		std::optional<devices::sensor_files> sensor_devices;
+		std::optional<mppt::controller> mppt_device;
+
+		{
+			const phase_timer timer("devices");
+
+			concurrently(
+				[&]
+				{
+					const phase_timer timer("pwm");
+					fan_pwm_device.emplace(sl::paths::PWM_CHIP, 0, FAN_PWM_CONTROL_FREQUENCY);
+				},
+				[&]
+				{
+					const phase_timer timer("iio");
+					sensor_devices.emplace(paths::CPU_TEMPERATURE, paths::IIO_DEVICE);
+				},
+				[&]
+				{
+					const phase_timer timer("mppt");
+					mppt_device.emplace(sl::paths::SERIAL0);
+				});
+		}
+
+		pwm::chip& fan_pwm = *fan_pwm_device;
+		mppt::controller& mppt = *mppt_device;
+
+		const io::file_descriptor& cpu_temp_file = sensor_devices->cpu_temperature;
+		const io::file_descriptor& air_temp_file = sensor_devices->air_temperature;
+		const io::file_descriptor& air_humidity_file = sensor_devices->air_humidity;
+		const io::file_descriptor& air_pressure_file = sensor_devices->air_pressure;
+		const io::file_descriptor& pool1_ec_file = sensor_devices->pool1_ec;
+		const io::file_descriptor& pool2_ec_file = sensor_devices->pool2_ec;
+
+		const sigset_t signals = stop_signals();
+		const io::file_descriptor signal_file(signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK));
+
+		scheduler.watch("signals", signal_file, [&signal_file]
+		{
+			signalfd_siginfo info;
+
+			if (signal_file.read(&info, sizeof(info)) == sizeof(info))
+			{
+				log_notice("signaled: %u.", info.ssi_signo);
+				common_stop_source.request_stop();
+			}
+		});
+
+		scheduler.watch("device supervisor", uevents, [&]
+		{
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			const alloc::exemption hotplug;
+#endif
+			if (devices::supervise(uevents, *sensor_devices))
+			{
+				notify_serial_added();
+			}
+		});
+
+		// Before anything is published, so that the readers see the relays turned off on start
+		shm::segment live_state(LIVE_STATE_NAME);
+
+		fan_controller fans(fan_relay, fan_pwm, tachometer_wakeup);
 
 		// Turn off relays on start
-		adjust_fans(fan_relay, fan_pwm, ABSOLUTE_ZERO);
+		fans.stop();
 		toggle_irrigation(irrigation_pumps, INVALID_MINUTE);
 
-		const std::filesystem::path bme680_path = find_iio_device("bme680");
-		const std::filesystem::path ads1115_path = find_iio_device("ads1015"); // ADS1015 and ADS1115 use the same driver
+		metrics::server metrics_server(metrics_socket_path());
+
+		std::jthread metrics_thread([&metrics_server, &stop]
+		{
+			footprint::register_thread("metrics");
+#ifdef SYKEROLABS_REALTIME
+			rt::enter(METRICS_THREAD);
+#endif
+			metrics_server.run(stop);
+		});
+		std::jthread float_switch_monitoring_thread(monitor_float_switches, std::cref(stop), std::cref(float_switches), std::cref(irrigation_pumps));
+		std::jthread fan_measurement_thread(measure_fans, std::cref(tachometer_wakeup), std::cref(fan_tachometers));
+		std::jthread mppt_monitoring_thread(monitor_mppt, std::cref(stop), std::ref(mppt));
 
-		io::file_descriptor cpu_temp_file(sl::paths::CPU_TEMPERATURE);
-		io::file_descriptor air_temp_file(bme680_path / "in_temp_input");
-		io::file_descriptor air_humidity_file(bme680_path / "in_humidityrelative_input");
-		io::file_descriptor air_pressure_file(bme680_path / "in_pressure_input");
-		io::file_descriptor pool1_ec_file(ads1115_path / "in_voltage0_raw");
-		io::file_descriptor pool2_ec_file(ads1115_path / "in_voltage1_raw");
-		mppt::controller mppt(sl::paths::SERIAL0);
+		sensor_properties sensors;
 
-		std::jthread float_switch_monitoring_thread(monitor_float_switches, common_stop_source, std::cref(float_switches));
-		std::jthread fan_measurement_thread(measure_fans, common_stop_source, std::cref(fan_tachometers));
-		std::jthread tds_measurement_thread(measure_tds, common_stop_source, std::cref(tds_probe_relay), std::ref(pool1_ec_file), std::ref(pool2_ec_file));
-		std::jthread mppt_monitoring_thread(monitor_mppt, common_stop_source, std::ref(mppt));
+		power::policy policy(POWER_TIERS, POWER_TIER_HYSTERESIS_VOLTS);
 
-		std::stop_token stop_token = common_stop_source.get_token();
+		// The sampling slows down in the lower power tiers
+		const auto scaled = [&policy](std::chrono::nanoseconds interval)
+		{
+			return [&policy, interval]
+			{
+				return interval * policy.current().sample_interval_scale;
+			};
+		};
 
-		log_debug("main loop %d started.", gettid());
+		const auto tds_interval = [&policy]
+		{
+			return std::chrono::nanoseconds(policy.current().tds_read_interval);
+		};
+
+		scheduler.every("cpu temperature", scaled(CPU_TEMPERATURE_SAMPLE_INTERVAL), [&](time::scheduler::clock::time_point)
+		{
+			char text[SYSFS_TEXT_SIZE];
+			sensors.cpu_temperature.parse(io::peek_some(cpu_temp_file, text)).commit();
+			gauges.cpu_temperature.set(sensors.cpu_temperature.get());
+		});
+
+		scheduler.every("air temperature", scaled(AIR_TEMPERATURE_SAMPLE_INTERVAL), [&](time::scheduler::clock::time_point)
+		{
+			char text[SYSFS_TEXT_SIZE];
+			const std::string_view value = io::peek_some(air_temp_file, text);
+			sensors.air_temperature.parse(value).commit();
+			sensors.fan_control_temperature.parse(value).commit();
+			gauges.air_temperature.set(sensors.air_temperature.get());
+		});
+
+		scheduler.every("air humidity", scaled(AIR_HUMIDITY_SAMPLE_INTERVAL), [&](time::scheduler::clock::time_point)
+		{
+			char text[SYSFS_TEXT_SIZE];
+			sensors.air_humidity.parse(io::peek_some(air_humidity_file, text)).commit();
+			gauges.air_humidity.set(sensors.air_humidity.get());
+		});
+
+		scheduler.every("air pressure", scaled(AIR_PRESSURE_SAMPLE_INTERVAL), [&](time::scheduler::clock::time_point)
+		{
+			char text[SYSFS_TEXT_SIZE];
+			sensors.air_pressure.parse(io::peek_some(air_pressure_file, text)).commit();
+			gauges.air_pressure.set(sensors.air_pressure.get());
+		});
+
+		constexpr gpio::line_value_pair PROBES_ON(pins::TDS_PROBE_RELAY, false);
+		constexpr gpio::line_value_pair PROBES_OFF(pins::TDS_PROBE_RELAY, true);
+
+		// One task for the whole cycle, so that the measurement always follows its own probes on, i.e. the probes are never left on
+		// when the power tier changes the interval in between. The interval is taken once per cycle, when the probes are off.
+		bool probes_on = false;
+
+		// The sampling interval is 8 times in a second, see datarate parameters in
+		// https://github.com/visuve/SykeroLabs3/wiki/Operating-system-configuration#full-bootfirmwareconfigtxt
+		scheduler.add("tds measurement", [&](time::scheduler::clock::time_point)
+		{
+			if (!probes_on)
+			{
+				tds_probe_relay.write_value(PROBES_ON);
+				probes_on = true;
+				return;
+			}
+
+			// A failed read must not leave the probes on, nor have the next deadline wait for the measurement
+			probes_on = false;
+
+			try
+			{
+				char text[SYSFS_TEXT_SIZE];
+				auto tds = tds_data.acquire();
+				tds->pool1.parse(io::peek_some(pool1_ec_file, text)).commit();
+				tds->pool2.parse(io::peek_some(pool2_ec_file, text)).commit();
+				gauges.pool1_ec.set(tds->pool1.get());
+				gauges.pool2_ec.set(tds->pool2.get());
+			}
+			catch (...)
+			{
+				tds_probe_relay.write_value(PROBES_OFF);
+				throw;
+			}
+
+			tds_probe_relay.write_value(PROBES_OFF);
+		}, [&](time::scheduler::clock::time_point now) -> time::scheduler::clock::time_point
+		{
+			if (probes_on)
+			{
+				return now + TDS_PROBE_WAKEUP_DELAY;
+			}
 
-		// This is basically a 10 min average; I do not want the fans to toggle on and off possibly every minute
-		rolling_average<10, float, std::milli> air_temperature;
-		snapshot<float, std::milli> cpu_temperature;
-		snapshot<float> air_humidity; // relative percent
-		snapshot<float> air_pressure; // hectopascal
+			const std::chrono::nanoseconds interval = tds_interval();
+			const std::chrono::nanoseconds next = (now.time_since_epoch() / interval + 1) * interval;
+			return time::scheduler::clock::time_point(std::chrono::duration_cast<time::scheduler::clock::duration>(next));
+		});
+
+		time::scheduler::clock::time_point fans_updated;
+
+		scheduler.every("fan control", scaled(FAN_CONTROL_INTERVAL), [&](time::scheduler::clock::time_point deadline)
+		{
+			const std::chrono::nanoseconds elapsed = fans_updated.time_since_epoch().count() ? deadline - fans_updated : FAN_CONTROL_INTERVAL;
+			fans_updated = deadline;
+
+			fans.update(time::is_night(deadline) ? ABSOLUTE_ZERO : sensors.fan_control_temperature.get(), elapsed);
+		});
+
+		// Own cursors, so that the averages of the CSV and the gauges are not reset
+		mppt::smoothed<float, std::milli>::cursor battery_volts = mppt.mppt_data.acquire()->battery_voltage.open_cursor();
+		mppt::smoothed<float, std::milli>::cursor battery_amperes = mppt.mppt_data.acquire()->battery_current.open_cursor();
+
+		time::scheduler::clock::time_point accounted;
+		uint64_t accounted_wakeups = scheduler.wakeups();
+		uint64_t accounted_context_switches = 0;
+
+		scheduler.every("power policy", POWER_POLICY_INTERVAL, [&](time::scheduler::clock::time_point deadline)
+		{
+			rusage usage = {};
+			getrusage(RUSAGE_SELF, &usage);
+
+			const uint64_t wakeups = scheduler.wakeups();
+			const uint64_t context_switches = static_cast<uint64_t>(usage.ru_nvcsw);
+
+			if (accounted.time_since_epoch().count())
+			{
+				policy.account(deadline - accounted, wakeups - accounted_wakeups, context_switches - accounted_context_switches);
+			}
 
-		float duty_percent = DUTY_PERCENTAGE_INVALID;
+			accounted = deadline;
+			accounted_wakeups = wakeups;
+			accounted_context_switches = context_switches;
 
-		for (int minute = time::local_time().tm_min + 1; !stop_token.stop_requested() && time::sleep_until_next_even<std::chrono::minutes>(); ++minute)
+			float volts = 0.0f;
+			float amperes = 0.0f;
+			int charger_state = 0;
+
+			{
+				auto md = mppt.mppt_data.acquire();
+				volts = md->battery_voltage.get(battery_volts);
+				amperes = md->battery_current.get(battery_amperes);
+				charger_state = md->state.get();
+			}
+
+			if (!policy.update(volts, amperes, charger_state))
+			{
+				return;
+			}
+
+			const power::tier& tier = policy.current();
+
+			fan_tachometers.detect_edges(tier.tachometers);
+			fans.closed_loop(tier.tachometers);
+			csv.set_commit_interval(tier.csv_commit_rows);
+		});
+
+		scheduler.every("minute tick", std::chrono::minutes(1), [&](time::scheduler::clock::time_point deadline)
 		{
-			cpu_temperature.parse(io::peek_some(cpu_temp_file)).commit();
-			air_temperature.parse(io::peek_some(air_temp_file)).commit();
-			air_humidity.parse(io::peek_some(air_humidity_file)).commit();
-			air_pressure.parse(io::peek_some(air_pressure_file)).commit();
+			tick_stats.lateness.record(time::scheduler::clock::now() - deadline);
+
+			const auto started = std::chrono::steady_clock::now();
+
+			const rollup_summary<float> cpu_temperature = sensors.cpu_temperature.summarize();
+			const rollup_summary<float> air_temperature = sensors.air_temperature.summarize();
+			const rollup_summary<float> air_humidity = sensors.air_humidity.summarize();
+			const rollup_summary<float> air_pressure = sensors.air_pressure.summarize();
+
+			const auto acquired = std::chrono::steady_clock::now();
+			tick_stats.acquisition.record(acquired - started);
 
 			// TODO: reduce unnecessary IO by storing the previous state or something
-			if (time::is_night())
+			if (time::is_night(deadline))
 			{
 				toggle_irrigation(irrigation_pumps, INVALID_MINUTE);
-				duty_percent = adjust_fans(fan_relay, fan_pwm, ABSOLUTE_ZERO);
 			}
 			else
 			{
-				toggle_irrigation(irrigation_pumps, minute);
-				duty_percent = adjust_fans(fan_relay, fan_pwm, air_temperature.get());
+				toggle_irrigation(irrigation_pumps, time::local_time(deadline).tm_min);
 			}
 
+			const auto actuated = std::chrono::steady_clock::now();
+			tick_stats.actuation.record(actuated - acquired);
+
+			// Copy everything out first, so that no lock is held while the row is written and synced
+			const float_switch_properties fsd = float_switch_data.snapshot();
+			const pump_properties pd = pump_data.snapshot();
+			const fan_properties fd = fan_data.snapshot();
+
+			uint32_t pool1_ec = 0;
+			uint32_t pool2_ec = 0;
 			{
-				auto fsd = float_switch_data.acquire();
-				auto pd = pump_data.acquire();
-				auto fd = fan_data.acquire();
 				auto td = tds_data.acquire();
-				auto md = mppt.mppt_data.acquire();
+				pool1_ec = td->pool1.get();
+				pool2_ec = td->pool2.get();
+			}
+
+			const mppt::mppt_values md = mppt.mppt_data.acquire()->values();
+
+			char timestamp[time::timestamp_formatter::MAX_LENGTH];
+
+			csv.append_row(
+				timestamps.format(CSV_TIMESTAMP_FORMAT, deadline, timestamp),
+				cpu_temperature.minimum,
+				cpu_temperature.maximum,
+				cpu_temperature.mean,
+				air_temperature.minimum,
+				air_temperature.maximum,
+				air_temperature.mean,
+				air_humidity.minimum,
+				air_humidity.maximum,
+				air_humidity.mean,
+				air_pressure.minimum,
+				air_pressure.maximum,
+				air_pressure.mean,
+				fsd.sensor1 ? STR_HIGH : STR_LOW,
+				fsd.sensor2 ? STR_HIGH : STR_LOW,
+				pd.pump1 ? STR_ON : STR_OFF,
+				pd.pump2 ? STR_ON : STR_OFF,
+				fans.on() ? STR_ON : STR_OFF,
+				fans.duty_percent(),
+				fd.fan1_rpm,
+				fd.fan2_rpm,
+				pool1_ec,
+				pool2_ec,
+				md.battery_voltage,
+				md.battery_current,
+				md.panel_voltage,
+				md.panel_power,
+				md.load_current,
+				md.state,
+				md.error,
+				md.yield_total,
+				md.max_power_today);
+
+			tick_stats.csv.record(std::chrono::steady_clock::now() - actuated);
+		});
+
+		scheduler.every("statistics", STATISTICS_LOG_INTERVAL, [&policy](time::scheduler::clock::time_point)
+		{
+			tick_stats.log();
+			event_stats.log();
+			policy.report();
+			footprint::report(MEMORY_BUDGET);
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			alloc::report();
+#endif
+		});
+
+#ifdef SYKEROLABS_SIMULATION
+		scheduler.every("simulation", sim::STEP_INTERVAL, [&](time::scheduler::clock::time_point deadline)
+		{
+			// The environment stands in for the hardware, its allocations are not ours
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			const alloc::exemption hardware;
+#endif
+			if (!sim::step(deadline))
+			{
+				common_stop_source.request_stop();
+			}
+		});
+
+		scheduler.every("simulated fans", scaled(FAN_CONTROL_INTERVAL), [&](time::scheduler::clock::time_point deadline)
+		{
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+			const alloc::exemption hardware;
+#endif
+			sim::spin_fans(deadline);
+		});
+#endif
+
+#ifdef SYKEROLABS_TRACE
+		// The signal handler only sets a flag, the file is written on this thread
+		scheduler.every("trace dump", TRACE_DUMP_POLL_INTERVAL, [](time::scheduler::clock::time_point deadline)
+		{
+			if (trace::dump_requested())
+			{
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+				const alloc::exemption on_request;
+#endif
+				trace::dump(trace_path(deadline));
+			}
+		});
+#endif
+
+		const auto startup = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startup_began);
+		log_info("startup took %lld ms.", static_cast<long long>(startup.count()));
+
+#ifdef SYKEROLABS_REALTIME
+		rt::enter(SCHEDULER_THREAD);
+		rt::lock_memory();
+#endif
+
+		log_debug("main loop %d started.", gettid());
+		footprint::register_thread("scheduler");
+
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+		alloc::mark_initialized();
+#endif
+
+		scheduler.run(stop);
+
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+		alloc::mark_stopped();
+#endif
 
-				csv.append_row(
-					time::datetime_string(),
-					cpu_temperature.get(),
-					air_temperature.get(),
-					air_humidity.get(),
-					air_pressure.get(),
-					fsd->sensor1 ? STR_HIGH : STR_LOW,
-					fsd->sensor2 ? STR_HIGH : STR_LOW,
-					pd->pump1 ? STR_ON : STR_OFF,
-					pd->pump2 ? STR_ON : STR_OFF,
-					duty_percent > DUTY_PERCENTAGE_MIN ? STR_ON : STR_OFF,
-					duty_percent,
-					fd->fan1_rpm,
-					fd->fan2_rpm,
-					td->pool1.get(),
-					td->pool2.get(),
-					md->battery_voltage.get(),
-					md->battery_current.get(),
-					md->panel_voltage.get(),
-					md->panel_power.get(),
-					md->load_current.get(),
-					md->state.get(),
-					md->error.get(),
-					md->yield_total.get(),
-					md->max_power_today.get());
-			}
-		}
-
-		// Turn off relays on exit
-		adjust_fans(fan_relay, fan_pwm, ABSOLUTE_ZERO);
+		// Turn off relays on exit, before anything else
+		fans.stop();
 		toggle_irrigation(irrigation_pumps, INVALID_MINUTE);
 
-		// If the fans are spinning, there should not be a reason to wait for the fans to spool down,
-		// because the fan rpm read function will block the jthread from exiting
+		tick_stats.log();
+		event_stats.log();
+		policy.report();
+		footprint::report(MEMORY_BUDGET);
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+		alloc::report();
+#endif
+
+		// The other threads have been woken up by the stop event as well, so joining them does not wait for the fans to spool down
 
 		log_debug("main loop %d stopped.", gettid());
 	}
 }
 
-int main(int, char** argv)
+int main([[maybe_unused]] int argc, char** argv)
 {
-	std::signal(SIGINT, sl::signal_handler);
-	std::signal(SIGTERM, sl::signal_handler);
+	// Before the first thread is started, so that every thread inherits the mask
+	const sigset_t stop_signals = sl::stop_signals();
+	pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+#ifdef SYKEROLABS_TRACE
+	std::signal(SIGUSR1, sl::trace_signal_handler);
+#endif
+
+#ifdef SYKEROLABS_RPIZ2W
+	// Before the log facility starts the first thread
+	sl::footprint::limit_thread_stacks(sl::THREAD_STACK_SIZE);
+#endif
 
 	sl::log::facility log_facility(1 << 3, argv[0]);
 
 	try
 	{
+#ifdef SYKEROLABS_SIMULATION
+		sl::sim::environment simulation(argc, argv);
+		sl::run();
+		simulation.report();
+
+		if (simulation.failed_scrapes() > 0)
+		{
+			log_error("metrics scrapes failed.");
+			return 1;
+		}
+
+		// Makes the simulation a test of the memory budget
+		if (sl::footprint::peak_resident_size() > sl::MEMORY_BUDGET)
+		{
+			log_error("peak resident size over the budget.");
+			return 1;
+		}
+#ifdef SYKEROLABS_ALLOCATION_TRACKING
+		// Makes the simulation a test of the steady state
+		if (sl::alloc::steady_state_allocations() > 0)
+		{
+			return 1;
+		}
+#endif
+#else
 		sl::run();
+#endif
 	}
 	catch (const std::system_error& e)
 	{
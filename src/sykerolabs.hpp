@@ -1,5 +1,10 @@
 #pragma once
 
+#include "sykero_time.hpp"
+#include "sykero_power.hpp"
+#include "sykerolabs_shm.h"
+#include "sykero_rt.hpp"
+
 namespace sl
 {
 	// See https://github.com/visuve/SykeroLabs3/wiki/Pin-configuration for more details
@@ -20,17 +25,23 @@ namespace sl
 
 	namespace paths
 	{
-		const std::filesystem::path CPU_TEMPERATURE("/sys/class/thermal/thermal_zone0/temp");
-		const std::filesystem::path IIO_DEVICE("/sys/bus/iio/devices/iio:device");
+#ifdef SYKEROLABS_SIMULATION
+		// The fake sysfs and device tree, see sykero_sim.hpp
+		const std::filesystem::path ROOT("/tmp/sykerolabs_simulation/");
+#else
+		const std::filesystem::path ROOT("/");
+#endif
+		const std::filesystem::path CPU_TEMPERATURE(ROOT / "sys/class/thermal/thermal_zone0/temp");
+		const std::filesystem::path IIO_DEVICE(ROOT / "sys/bus/iio/devices/iio:device");
 #ifdef SYKEROLABS_RPI5
-		const std::filesystem::path PWM_CHIP("/sys/class/pwm/pwmchip2");
-		const std::filesystem::path GPIO_CHIP("/dev/gpiochip4");
+		const std::filesystem::path PWM_CHIP(ROOT / "sys/class/pwm/pwmchip2");
+		const std::filesystem::path GPIO_CHIP(ROOT / "dev/gpiochip4");
 #endif
 #ifdef SYKEROLABS_RPIZ2W
-		const std::filesystem::path PWM_CHIP("/sys/class/pwm/pwmchip0");
-		const std::filesystem::path GPIO_CHIP("/dev/gpiochip0");
+		const std::filesystem::path PWM_CHIP(ROOT / "sys/class/pwm/pwmchip0");
+		const std::filesystem::path GPIO_CHIP(ROOT / "dev/gpiochip0");
 #endif
-		const std::filesystem::path SERIAL0("/dev/serial0");
+		const std::filesystem::path SERIAL0(ROOT / "dev/serial0");
 	}
 
 	constexpr float ABSOLUTE_ZERO = -273.15f;
@@ -38,6 +49,27 @@ namespace sl
 	constexpr float MAX_FAN_TOGGLE_CELCIUS = 40.0f;
 	constexpr float FAN_TEMPERATURE_STEP = 100.0f / (MAX_FAN_TOGGLE_CELCIUS - MIN_FAN_TOGGLE_CELCIUS);
 
+	// The fan relay turns on this much above MIN_FAN_TOGGLE_CELCIUS and off at it
+	constexpr float FAN_TOGGLE_HYSTERESIS_CELCIUS = 1.0f;
+
+	// The target speed rises linearly from the minimum to the maximum between the toggle temperatures.
+	// Most PWM fans keep spinning at their minimum speed at 0% duty, so the old linear duty is the feed-forward term.
+	constexpr float FAN_MIN_RPM = 600.0f;
+	constexpr float FAN_MAX_RPM = 3000.0f;
+	constexpr float FAN_RPM_STEP = (FAN_MAX_RPM - FAN_MIN_RPM) / (MAX_FAN_TOGGLE_CELCIUS - MIN_FAN_TOGGLE_CELCIUS);
+	constexpr uint32_t FAN_TACHOMETER_PULSES_PER_REVOLUTION = 2;
+
+	// The gains of the PI controller, from RPM to duty percent
+	constexpr float FAN_PROPORTIONAL_GAIN = 0.02f;
+	constexpr float FAN_INTEGRAL_GAIN = 0.01f; // per second
+
+	// Smaller changes of the duty cycle are not written, so the fans are not hunting around the target
+	constexpr float FAN_DUTY_DEADBAND_PERCENT = 1.0f;
+
+	// A powered fan which has not reported this speed for the timeout is stalled, and it is left out of the control
+	constexpr float FAN_STALL_RPM = 200.0f;
+	constexpr std::chrono::seconds FAN_STALL_TIMEOUT(15);
+
 	constexpr int INVALID_MINUTE = -1;
 
 	constexpr float DUTY_PERCENTAGE_INVALID = -1.0f;
@@ -47,20 +79,116 @@ namespace sl
 	constexpr size_t MAX_SERIAL_BUFFER_SIZE = 256;
 	constexpr size_t MAX_SERIAL_STRING_LENGTH = 32;
 
+	// The stack buffer for a sysfs attribute, e.g. in_temp_input
+	constexpr size_t SYSFS_TEXT_SIZE = 32;
+
 	// Fans use 25kHz https://www.mouser.com/pdfDocs/San_Ace_EPWMControlFunction.pdf
 	// https://noctua.at/pub/media/wysiwyg/Noctua_PWM_specifications_white_paper.pdf
 	constexpr float FAN_PWM_CONTROL_FREQUENCY = 25000.0f;
 
-	constexpr std::chrono::days LOG_ROTATION_INTERVAL(1);
+	// How often the tick latency histograms are written to the journal
+	constexpr std::chrono::hours STATISTICS_LOG_INTERVAL(1);
+
+	// The format of the CSV time column. The change-driven CSV mode reader expects the default DATETIME format.
+	constexpr time::timestamp_format CSV_TIMESTAMP_FORMAT = time::timestamp_format::DATETIME;
+
+	// In the change-driven CSV mode every 60th row is written in full, i.e. once per hour
+	constexpr size_t CSV_KEYFRAME_INTERVAL = 60;
 
 	// I do not have an oscilloscope so these values are arbitrary
 	constexpr std::chrono::milliseconds WATER_LEVEL_SENSOR_DEBOUNCE(10);
+
+	// The float switch opens when the water drops below it, and the line is pulled high. Each switch guards the pump of its pool.
+	constexpr bool WATER_LEVEL_DRY = true;
+
+	// From a dry float switch edge to the pump relay being cut, longer is logged
+	constexpr std::chrono::milliseconds INTERLOCK_LATENCY_TARGET(5);
+
 	constexpr std::chrono::microseconds FAN_TACHOMETER_DEBOUNCE(100);
 	constexpr std::chrono::seconds TDS_PROBE_WAKEUP_DELAY(1);
 	constexpr std::chrono::minutes TDS_READ_INTERVAL(7);
 
-	// Completely arbitrary value. Change if needed. I have two.
-	constexpr size_t MAX_IIO_DEVICES = 9;
+	// Sampling intervals of the sensors. The CSV rows carry the minimum, maximum and mean of each minute.
+	constexpr std::chrono::seconds CPU_TEMPERATURE_SAMPLE_INTERVAL(5);
+	constexpr std::chrono::seconds AIR_TEMPERATURE_SAMPLE_INTERVAL(1);
+	constexpr std::chrono::seconds AIR_HUMIDITY_SAMPLE_INTERVAL(5);
+	constexpr std::chrono::seconds AIR_PRESSURE_SAMPLE_INTERVAL(10);
+
+	// How often the fan speed is controlled. The relay hysteresis keeps the fans from toggling on and off, so the temperature window can be short.
+	constexpr std::chrono::seconds FAN_CONTROL_INTERVAL(1);
+	constexpr std::chrono::minutes FAN_CONTROL_AVERAGE_WINDOW(1);
+	constexpr size_t FAN_CONTROL_AVERAGE_CAPACITY = FAN_CONTROL_AVERAGE_WINDOW / AIR_TEMPERATURE_SAMPLE_INTERVAL + 1;
+
+	// How often a trace dump requested with SIGUSR1 is checked for
+	constexpr std::chrono::seconds TRACE_DUMP_POLL_INTERVAL(1);
+
+	// Created in $XDG_RUNTIME_DIR, or in /tmp if it is not set
+#ifdef SYKEROLABS_SIMULATION
+	constexpr char METRICS_SOCKET_NAME[] = "sykerolabs_simulation.sock";
+#else
+	constexpr char METRICS_SOCKET_NAME[] = "sykerolabs.sock";
+#endif
+
+	inline std::filesystem::path metrics_socket_path()
+	{
+		const char* runtime_directory = getenv("XDG_RUNTIME_DIR");
+
+		return std::filesystem::path(runtime_directory ? runtime_directory : "/tmp") / METRICS_SOCKET_NAME;
+	}
+
+	// The live state segment in /dev/shm, see sykerolabs_shm.h
+#ifdef SYKEROLABS_SIMULATION
+	constexpr char LIVE_STATE_NAME[] = "/sykerolabs_simulation";
+#else
+	constexpr char LIVE_STATE_NAME[] = SYKEROLABS_SHM_NAME;
+#endif
+
+	// A lost serial port is reopened when the kernel reports a new tty, but at least this often,
+	// because e.g. the /dev/serial0 link is created by udev only after the kernel has reported the tty
+	constexpr std::chrono::seconds SERIAL_REOPEN_INTERVAL(1);
+
+	// The peak resident size the process should stay under, reported hourly and checked at the end of a simulation
+#ifdef SYKEROLABS_RPIZ2W
+	// The 512 MiB are shared with the camera pipeline, and the default 8 MiB thread stacks are mostly unused
+	constexpr size_t MEMORY_BUDGET = 16 << 20;
+	constexpr size_t THREAD_STACK_SIZE = 0x40000;
+
+	static_assert(rt::STACK_PREFAULT_SIZE < THREAD_STACK_SIZE, "The prefault would overflow the limited thread stacks");
+#else
+	constexpr size_t MEMORY_BUDGET = 64 << 20;
+#endif
+
+#ifdef SYKEROLABS_REALTIME
+	// The camera pipeline runs on the first two cores, so the time critical threads are kept on the last two.
+	// The edges are handled before the minute tick, and the rest can wait.
+	constexpr rt::thread_profile FLOAT_SWITCH_THREAD = { "float switches", 3, SCHED_FIFO, 80 };
+	constexpr rt::thread_profile FAN_TACHOMETER_THREAD = { "tachometers", 3, SCHED_FIFO, 70 };
+	constexpr rt::thread_profile SCHEDULER_THREAD = { "scheduler", 2, SCHED_FIFO, 60 };
+	constexpr rt::thread_profile MPPT_THREAD = { "mppt", 2, SCHED_RR, 50 };
+	constexpr rt::thread_profile METRICS_THREAD = { "metrics", -1, SCHED_OTHER, 0 };
+
+	constexpr std::array<rt::thread_profile, 5> THREAD_PROFILES =
+	{
+		FLOAT_SWITCH_THREAD,
+		FAN_TACHOMETER_THREAD,
+		SCHEDULER_THREAD,
+		MPPT_THREAD,
+		METRICS_THREAD
+	};
+#endif
+
+	// How often the power tier is checked against the mean of the battery readings since the previous check
+	constexpr std::chrono::minutes POWER_POLICY_INTERVAL(1);
+
+	// A 12 V lead-acid battery under a light load. The log levels are the syslog priorities, e.g. 5 for notice.
+	constexpr float POWER_TIER_HYSTERESIS_VOLTS = 0.2f;
+
+	constexpr std::array<power::tier, 3> POWER_TIERS =
+	{{
+		{ "full", 0.0f, 1, TDS_READ_INTERVAL, 7, true, 1 },
+		{ "saving", 12.2f, 4, TDS_READ_INTERVAL * 4, 5, false, 5 },
+		{ "survival", 11.9f, 12, TDS_READ_INTERVAL * 8, 4, false, 15 }
+	}};
 
 	constexpr char STR_ON[] = "on";
 	constexpr char STR_OFF[] = "off";
@@ -0,0 +1,221 @@
+#pragma once
+
+/*
+ * The live state of sykerolabs in a POSIX shared memory segment, for readers in other processes, e.g. a dashboard.
+ * This header is plain C and has no dependencies; a reader maps the segment once and reads it without system calls.
+ * In strict C modes define _POSIX_C_SOURCE as 200809L or later, for shm_open and O_CLOEXEC.
+ *
+ * The layout is fixed and little-endian with natural alignment, so that it can be read without this header too,
+ * e.g. with the mmap and struct modules of Python:
+ *
+ *   offset  size  header
+ *        0     4  magic, SYKEROLABS_SHM_MAGIC
+ *        4     2  version, SYKEROLABS_SHM_VERSION
+ *        6     2  header size, 64
+ *        8     4  slot size, 32
+ *       12     4  slot count
+ *       16     4  pid of the writer, 0 once it has exited
+ *       20     4  reserved
+ *       24     8  start time of the writer, nanoseconds since the Unix epoch
+ *       32    32  reserved
+ *
+ *   offset  size  slot, at 64 + index * 32
+ *        0     4  sequence, odd while the slot is being written
+ *        4     4  reserved
+ *        8     8  timestamp of the latest update, nanoseconds since the Unix epoch, 0 if never updated
+ *       16     8  value, IEEE 754 double
+ *       24     8  number of updates
+ *
+ * Each slot is a seqlock: read the sequence, the fields and the sequence again, and retry if the sequence was odd or changed.
+ * The values are published as they change, e.g. the fan speeds on each tachometer reading and the MPPT values on each block.
+ * The version changes whenever the layout or the meaning of a slot changes. New slots are only ever appended.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SYKEROLABS_SHM_NAME "/sykerolabs"
+#define SYKEROLABS_SHM_MAGIC 0x4C4B5953u /* "SYKL" */
+#define SYKEROLABS_SHM_VERSION 1u
+
+/* A slot whose writer died in the middle of an update stays odd, so a read gives up after this many attempts */
+#define SYKEROLABS_SHM_READ_ATTEMPTS 10000u
+
+enum sykerolabs_shm_value
+{
+	SYKEROLABS_SHM_CPU_TEMPERATURE, /* Celsius, the mean of the current minute */
+	SYKEROLABS_SHM_AIR_TEMPERATURE, /* Celsius, the mean of the current minute */
+	SYKEROLABS_SHM_AIR_HUMIDITY, /* Relative percent, the mean of the current minute */
+	SYKEROLABS_SHM_AIR_PRESSURE, /* Hectopascal, the mean of the current minute */
+	SYKEROLABS_SHM_WATER_LEVEL_SENSOR_1, /* 1 is high */
+	SYKEROLABS_SHM_WATER_LEVEL_SENSOR_2,
+	SYKEROLABS_SHM_PUMP_1, /* 1 is on */
+	SYKEROLABS_SHM_PUMP_2,
+	SYKEROLABS_SHM_FAN_RELAY, /* 1 is on */
+	SYKEROLABS_SHM_FAN_DUTY_PERCENT,
+	SYKEROLABS_SHM_FAN_1_RPM,
+	SYKEROLABS_SHM_FAN_2_RPM,
+	SYKEROLABS_SHM_POOL_1_EC, /* Raw electrical conductivity reading */
+	SYKEROLABS_SHM_POOL_2_EC,
+	SYKEROLABS_SHM_BATTERY_VOLTAGE, /* Volts */
+	SYKEROLABS_SHM_BATTERY_CURRENT, /* Amperes, negative while discharging */
+	SYKEROLABS_SHM_PANEL_VOLTAGE, /* Volts */
+	SYKEROLABS_SHM_PANEL_POWER, /* Watts */
+	SYKEROLABS_SHM_LOAD_CURRENT, /* Amperes */
+	SYKEROLABS_SHM_MPPT_STATE, /* VE.Direct CS */
+	SYKEROLABS_SHM_MPPT_ERROR, /* VE.Direct ERR */
+	SYKEROLABS_SHM_YIELD_TOTAL, /* Kilowatt hours */
+	SYKEROLABS_SHM_MAX_POWER_TODAY, /* Watts */
+	SYKEROLABS_SHM_VALUE_COUNT
+};
+
+struct sykerolabs_shm_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	int32_t pid;
+	uint32_t reserved1;
+	int64_t started_ns;
+	uint64_t reserved2[4];
+};
+
+struct sykerolabs_shm_slot
+{
+	uint32_t sequence;
+	uint32_t reserved;
+	int64_t timestamp_ns;
+	double value;
+	uint64_t updates;
+};
+
+struct sykerolabs_shm
+{
+	struct sykerolabs_shm_header header;
+	struct sykerolabs_shm_slot slots[SYKEROLABS_SHM_VALUE_COUNT];
+};
+
+/* A consistent copy of a slot */
+struct sykerolabs_shm_sample
+{
+	int64_t timestamp_ns;
+	double value;
+	uint64_t updates;
+};
+
+/* Maps the segment read only, e.g. sykerolabs_shm_open(SYKEROLABS_SHM_NAME). Returns NULL with errno set if it does not exist or has another version. */
+static inline const struct sykerolabs_shm* sykerolabs_shm_open(const char* name)
+{
+	const int descriptor = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	struct stat status;
+	void* mapping = MAP_FAILED;
+
+	if (descriptor < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(descriptor, &status) == 0 && status.st_size >= (off_t)sizeof(struct sykerolabs_shm))
+	{
+		mapping = mmap(NULL, sizeof(struct sykerolabs_shm), PROT_READ, MAP_SHARED, descriptor, 0);
+	}
+	else
+	{
+		errno = EPROTO;
+	}
+
+	close(descriptor);
+
+	if (mapping == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	const struct sykerolabs_shm* shm = (const struct sykerolabs_shm*)mapping;
+
+	if (__atomic_load_n(&shm->header.magic, __ATOMIC_ACQUIRE) != SYKEROLABS_SHM_MAGIC ||
+		shm->header.version != SYKEROLABS_SHM_VERSION)
+	{
+		munmap(mapping, sizeof(struct sykerolabs_shm));
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return shm;
+}
+
+static inline void sykerolabs_shm_close(const struct sykerolabs_shm* shm)
+{
+	munmap((void*)shm, sizeof(struct sykerolabs_shm));
+}
+
+/* The writer has exited, i.e. the values are final. A new writer creates a new segment, which is seen by opening it again. */
+static inline int sykerolabs_shm_stopped(const struct sykerolabs_shm* shm)
+{
+	return __atomic_load_n(&shm->header.pid, __ATOMIC_ACQUIRE) == 0;
+}
+
+/* Returns 0 on success, -1 if the slot did not settle within SYKEROLABS_SHM_READ_ATTEMPTS */
+static inline int sykerolabs_shm_read(const struct sykerolabs_shm* shm, enum sykerolabs_shm_value index, struct sykerolabs_shm_sample* sample)
+{
+	const struct sykerolabs_shm_slot* slot = &shm->slots[index];
+
+	for (unsigned attempt = 0; attempt < SYKEROLABS_SHM_READ_ATTEMPTS; ++attempt)
+	{
+		const uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+		if (before & 1u)
+		{
+			continue;
+		}
+
+		sample->timestamp_ns = __atomic_load_n(&slot->timestamp_ns, __ATOMIC_RELAXED);
+		__atomic_load(&slot->value, &sample->value, __ATOMIC_RELAXED);
+		sample->updates = __atomic_load_n(&slot->updates, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before)
+		{
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Reads every slot into an array of SYKEROLABS_SHM_VALUE_COUNT samples. Each sample is consistent by itself. Returns the number of slots read. */
+static inline int sykerolabs_shm_snapshot(const struct sykerolabs_shm* shm, struct sykerolabs_shm_sample* samples)
+{
+	int result = 0;
+
+	for (int index = 0; index < SYKEROLABS_SHM_VALUE_COUNT; ++index)
+	{
+		if (sykerolabs_shm_read(shm, (enum sykerolabs_shm_value)index, &samples[index]) == 0)
+		{
+			++result;
+		}
+		else
+		{
+			memset(&samples[index], 0, sizeof(samples[index]));
+		}
+	}
+
+	return result;
+}
+
+#ifdef __cplusplus
+}
+#endif